@@ -0,0 +1,76 @@
+#include "bloom_filter.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace steelbox;
+
+namespace {
+
+	std::uint64_t fnv1a(const std::string& item) {
+		std::uint64_t hash{ 14695981039346656037ULL };
+
+		for (unsigned char c : item) {
+			hash ^= c;
+			hash *= 1099511628211ULL;
+		}
+
+		return hash;
+	}
+
+	std::uint64_t mix(std::uint64_t value) {
+		value += 0x9E3779B97F4A7C15ULL;
+		value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+
+		return value ^ (value >> 31);
+	}
+
+}
+
+bloom_filter::bloom_filter(std::size_t expected_items, double false_positive_rate) {
+	if (false_positive_rate <= 0.0 || false_positive_rate >= 1.0) {
+		throw std::invalid_argument{ "false positive rate must be between 0 and 1" };
+	}
+
+	const double ln2{ std::log(2.0) };
+	const double items{ static_cast<double>(std::max<std::size_t>(expected_items, 1)) };
+	const double bits{ std::ceil(-items * std::log(false_positive_rate) / (ln2 * ln2)) };
+	const std::size_t word_count{ std::max<std::size_t>(static_cast<std::size_t>(std::ceil(bits / 64.0)), 1) };
+
+	this->bit_count = word_count * 64;
+	this->hash_count = std::max<std::size_t>(static_cast<std::size_t>(std::round(static_cast<double>(this->bit_count) / items * ln2)), 1);
+	this->words.reset(new std::atomic<std::uint64_t>[word_count]);
+	for (std::size_t i = 0; i < word_count; ++i) {
+		this->words[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+void bloom_filter::insert(const std::string& item) {
+	const std::uint64_t hash{ fnv1a(item) };
+	const std::uint64_t step{ mix(hash) | 1 };
+
+	for (std::size_t i = 0; i < this->hash_count; ++i) {
+		const std::uint64_t bit{ this->bit_index(hash, step, i) };
+		this->words[bit / 64].fetch_or(std::uint64_t{ 1 } << (bit % 64), std::memory_order_release);
+	}
+}
+
+bool bloom_filter::might_contain(const std::string& item) const {
+	const std::uint64_t hash{ fnv1a(item) };
+	const std::uint64_t step{ mix(hash) | 1 };
+
+	for (std::size_t i = 0; i < this->hash_count; ++i) {
+		const std::uint64_t bit{ this->bit_index(hash, step, i) };
+		if ((this->words[bit / 64].load(std::memory_order_acquire) & (std::uint64_t{ 1 } << (bit % 64))) == 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+std::uint64_t bloom_filter::bit_index(std::uint64_t hash, std::uint64_t step, std::size_t i) const {
+	// double hashing, see Kirsch and Mitzenmacher
+	return (mix(hash ^ 0x5851F42D4C957F2DULL) + i * step) % this->bit_count;
+}
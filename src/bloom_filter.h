@@ -0,0 +1,37 @@
+#ifndef STEELBOX_BLOOM_FILTER_H
+#define STEELBOX_BLOOM_FILTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace steelbox {
+
+	// Probabilistic set membership: might_contain never returns false for an
+	// inserted item. Inserts and lookups may run concurrently.
+	class bloom_filter {
+		public:
+			bloom_filter(std::size_t expected_items, double false_positive_rate);
+			bloom_filter(const bloom_filter&) = delete;
+
+			~bloom_filter() = default;
+
+			bloom_filter& operator=(const bloom_filter&) = delete;
+
+			void insert(const std::string& item);
+			bool might_contain(const std::string& item) const;
+
+		private:
+			std::uint64_t bit_index(std::uint64_t hash, std::uint64_t step, std::size_t i) const;
+
+		private:
+			std::size_t bit_count;
+			std::size_t hash_count;
+			std::unique_ptr<std::atomic<std::uint64_t>[]> words;
+	};
+
+}
+
+#endif // STEELBOX_BLOOM_FILTER_H
@@ -0,0 +1,100 @@
+#include "body_streambuf.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <utility>
+
+using namespace steelbox;
+
+namespace {
+
+	const std::size_t minimum_body_capacity = 256;
+
+	std::atomic<std::uint64_t> total_bodies{ 0 };
+	std::atomic<std::uint64_t> total_body_bytes{ 0 };
+	std::atomic<std::uint64_t> total_allocated_bytes{ 0 };
+	std::atomic<std::uint64_t> peak_body_bytes{ 0 };
+
+}
+
+body_streambuf::body_streambuf() :
+	allocated_bytes(0) {
+	this->setp(nullptr, nullptr);
+}
+
+body_buffer_statistics body_streambuf::statistics() {
+	body_buffer_statistics statistics;
+	statistics.bodies = total_bodies.load();
+	statistics.body_bytes = total_body_bytes.load();
+	statistics.allocated_bytes = total_allocated_bytes.load();
+	statistics.peak_body_bytes = peak_body_bytes.load();
+
+	return statistics;
+}
+
+std::string body_streambuf::release() {
+	const std::uint64_t body_size{ this->written_size() };
+	++total_bodies;
+	total_body_bytes += body_size;
+	total_allocated_bytes += this->allocated_bytes;
+	std::uint64_t peak{ peak_body_bytes.load() };
+	while (body_size > peak && !peak_body_bytes.compare_exchange_weak(peak, body_size)) {
+	}
+
+	this->body.resize(this->written_size());
+	this->setp(nullptr, nullptr);
+	this->allocated_bytes = 0;
+
+	std::string released{ std::move(this->body) };
+	this->body.clear();
+
+	return released;
+}
+
+body_streambuf::int_type body_streambuf::overflow(int_type character) {
+	if (traits_type::eq_int_type(character, traits_type::eof())) {
+		return traits_type::not_eof(character);
+	}
+
+	this->grow(this->written_size() + 1);
+	*this->pptr() = traits_type::to_char_type(character);
+	// the put area restarts at the write position rather than being bumped,
+	// pbump takes an int and would overflow on bodies above 2 GiB
+	this->setp(this->pptr() + 1, this->epptr());
+
+	return character;
+}
+
+std::streamsize body_streambuf::xsputn(const char_type* data, std::streamsize size) {
+	if (size <= 0) {
+		return 0;
+	}
+
+	if (this->epptr() - this->pptr() < size) {
+		this->grow(this->written_size() + static_cast<std::size_t>(size));
+	}
+	std::memcpy(this->pptr(), data, static_cast<std::size_t>(size));
+	this->setp(this->pptr() + size, this->epptr());
+
+	return size;
+}
+
+// the put area only ever covers the unwritten tail of the body
+std::size_t body_streambuf::written_size() const {
+	return this->pptr() == nullptr ? 0 : static_cast<std::size_t>(this->pptr() - this->body.data());
+}
+
+void body_streambuf::grow(std::size_t minimum_size) {
+	const std::size_t used{ this->written_size() };
+
+	// resizing the string frees its previous buffer, so no outgrown copy stays behind
+	this->body.resize(std::max(minimum_size, std::max(2 * this->body.size(), minimum_body_capacity)));
+	this->allocated_bytes += this->body.size();
+	this->setp(&this->body[0] + used, &this->body[0] + this->body.size());
+}
+
+input_streambuf::input_streambuf(const char* data, std::size_t size) {
+	char* begin{ const_cast<char*>(data) };
+
+	this->setg(begin, begin, begin + size);
+}
@@ -0,0 +1,63 @@
+#ifndef STEELBOX_BODY_STREAMBUF_H
+#define STEELBOX_BODY_STREAMBUF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <streambuf>
+#include <string>
+
+namespace steelbox {
+
+	struct body_buffer_statistics {
+		std::uint64_t bodies;
+		std::uint64_t body_bytes;
+		// buffer capacity taken while the bodies grew, outgrown buffers included
+		std::uint64_t allocated_bytes;
+		std::uint64_t peak_body_bytes;
+	};
+
+	// Output buffer writing straight into the string of a response body,
+	// which is then moved into the response instead of being copied out.
+	class body_streambuf : public std::streambuf {
+		public:
+			body_streambuf();
+			body_streambuf(const body_streambuf&) = delete;
+
+			~body_streambuf() = default;
+
+			body_streambuf& operator=(const body_streambuf&) = delete;
+
+			// totals of the bodies released so far by all buffers
+			static body_buffer_statistics statistics();
+
+			// hands over what was written, the buffer is empty afterwards
+			std::string release();
+
+		protected:
+			virtual int_type overflow(int_type character);
+			virtual std::streamsize xsputn(const char_type* data, std::streamsize size);
+
+		private:
+			std::size_t written_size() const;
+			void grow(std::size_t minimum_size);
+
+		private:
+			std::string body;
+			std::size_t allocated_bytes;
+	};
+
+	// Read-only view of memory owned by someone else, used to parse request
+	// bodies without copying them into a std::istringstream.
+	class input_streambuf : public std::streambuf {
+		public:
+			input_streambuf(const char* data, std::size_t size);
+			input_streambuf(const input_streambuf&) = delete;
+
+			~input_streambuf() = default;
+
+			input_streambuf& operator=(const input_streambuf&) = delete;
+	};
+
+}
+
+#endif // STEELBOX_BODY_STREAMBUF_H
@@ -0,0 +1,141 @@
+#include "circuit_breaker.h"
+#include <stdexcept>
+
+using namespace steelbox;
+
+circuit_breaker_settings::circuit_breaker_settings() :
+	failure_rate(0.5),
+	minimum_calls(20),
+	window(10),
+	open_duration(5000),
+	half_open_calls(3),
+	slow_call_duration(0) {
+}
+
+circuit_breaker::circuit_breaker(const circuit_breaker_settings& settings) :
+	settings(settings),
+	state(circuit_state::closed),
+	generation(0),
+	probes_in_flight(0),
+	probe_successes(0),
+	totals() {
+	if (settings.failure_rate <= 0.0 || settings.failure_rate > 1.0) {
+		throw std::invalid_argument{ "failure rate must be in (0, 1]" };
+	}
+	if (settings.window.count() <= 0 || settings.open_duration.count() <= 0 || settings.half_open_calls == 0) {
+		throw std::invalid_argument{ "window, open duration and half open calls must be positive" };
+	}
+
+	this->buckets.resize(static_cast<std::size_t>(settings.window.count()), bucket{ -1, 0, 0 });
+}
+
+circuit_breaker::permit circuit_breaker::acquire() {
+	const std::chrono::steady_clock::time_point now{ std::chrono::steady_clock::now() };
+	std::lock_guard<std::mutex> lock{ this->mutex };
+
+	if (this->state == circuit_state::open) {
+		const std::chrono::steady_clock::time_point reopens_at{ this->opened_at + this->settings.open_duration };
+		if (now < reopens_at) {
+			++this->totals.rejected_calls;
+			return permit{ false, false, std::chrono::duration_cast<std::chrono::milliseconds>(reopens_at - now), this->generation };
+		}
+
+		this->state = circuit_state::half_open;
+		this->probes_in_flight = 0;
+		this->probe_successes = 0;
+	}
+
+	if (this->state == circuit_state::half_open) {
+		if (this->probes_in_flight + this->probe_successes >= this->settings.half_open_calls) {
+			++this->totals.rejected_calls;
+			return permit{ false, false, this->settings.open_duration, this->generation };
+		}
+
+		++this->probes_in_flight;
+		return permit{ true, true, std::chrono::milliseconds{ 0 }, this->generation };
+	}
+
+	return permit{ true, false, std::chrono::milliseconds{ 0 }, this->generation };
+}
+
+void circuit_breaker::release(const permit& call_permit, bool failed, const std::chrono::microseconds& duration) {
+	const std::chrono::steady_clock::time_point now{ std::chrono::steady_clock::now() };
+	const bool slow{ this->settings.slow_call_duration.count() > 0 && duration > this->settings.slow_call_duration };
+	std::lock_guard<std::mutex> lock{ this->mutex };
+
+	++this->totals.calls;
+	this->totals.total_latency_us += static_cast<std::uint64_t>(duration.count());
+	if (failed) {
+		++this->totals.failures;
+	} else if (slow) {
+		++this->totals.slow_calls;
+	}
+	failed = failed || slow;
+
+	if (call_permit.probe) {
+		// probes granted before the breaker opened again no longer matter
+		if (this->state != circuit_state::half_open || call_permit.generation != this->generation) {
+			return;
+		}
+
+		--this->probes_in_flight;
+		if (failed) {
+			this->open(now);
+		} else if (++this->probe_successes >= this->settings.half_open_calls) {
+			this->state = circuit_state::closed;
+			for (bucket& window_bucket : this->buckets) {
+				window_bucket = bucket{ -1, 0, 0 };
+			}
+		}
+		return;
+	}
+
+	// calls granted while closed that finish after the breaker opened are not counted again
+	if (this->state != circuit_state::closed) {
+		return;
+	}
+
+	const std::int64_t second{ std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count() };
+	bucket& call_bucket{ this->current_bucket(second) };
+	++call_bucket.calls;
+	if (failed) {
+		++call_bucket.failures;
+	}
+
+	std::size_t window_calls{ 0 };
+	std::size_t window_failures{ 0 };
+	for (const bucket& window_bucket : this->buckets) {
+		if (window_bucket.second > second - this->settings.window.count()) {
+			window_calls += window_bucket.calls;
+			window_failures += window_bucket.failures;
+		}
+	}
+	if (window_calls >= this->settings.minimum_calls && window_failures >= this->settings.failure_rate * window_calls) {
+		this->open(now);
+	}
+}
+
+circuit_breaker_statistics circuit_breaker::statistics() const {
+	std::lock_guard<std::mutex> lock{ this->mutex };
+	circuit_breaker_statistics statistics{ this->totals };
+	statistics.state = this->state;
+
+	return statistics;
+}
+
+void circuit_breaker::open(const std::chrono::steady_clock::time_point& now) {
+	this->state = circuit_state::open;
+	this->opened_at = now;
+	++this->generation;
+	this->probes_in_flight = 0;
+	this->probe_successes = 0;
+}
+
+circuit_breaker::bucket& circuit_breaker::current_bucket(std::int64_t second) {
+	bucket& window_bucket{ this->buckets[static_cast<std::size_t>(second % this->settings.window.count())] };
+	if (window_bucket.second != second) {
+		window_bucket = bucket{ second, 0, 0 };
+	}
+
+	return window_bucket;
+}
@@ -0,0 +1,95 @@
+#ifndef STEELBOX_CIRCUIT_BREAKER_H
+#define STEELBOX_CIRCUIT_BREAKER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace steelbox {
+
+	struct circuit_breaker_settings {
+		circuit_breaker_settings();
+
+		// the breaker opens when this share of the calls in the window failed
+		double failure_rate;
+		// and the window holds at least this many calls
+		std::size_t minimum_calls;
+		std::chrono::seconds window;
+		// time spent open before probe calls are let through
+		std::chrono::milliseconds open_duration;
+		// probe calls that must all succeed to close the breaker again
+		std::size_t half_open_calls;
+		// successful calls slower than this count as failures, zero disables it
+		std::chrono::milliseconds slow_call_duration;
+	};
+
+	enum class circuit_state {
+		closed,
+		open,
+		half_open
+	};
+
+	struct circuit_breaker_statistics {
+		circuit_state state;
+		std::uint64_t calls;
+		std::uint64_t failures;
+		std::uint64_t slow_calls;
+		std::uint64_t rejected_calls;
+		std::uint64_t total_latency_us;
+	};
+
+	// Tracks the outcome of calls to a dependency and rejects calls while it
+	// is failing, so that callers fail fast instead of waiting out timeouts.
+	class circuit_breaker {
+		public:
+			struct permit {
+				bool granted;
+				// set for the limited calls let through while half open
+				bool probe;
+				// when granted is false, time until probe calls are let through
+				std::chrono::milliseconds retry_after;
+				// number of times the breaker had opened when the permit was granted
+				std::uint64_t generation;
+			};
+
+		public:
+			circuit_breaker(const circuit_breaker_settings& settings);
+			circuit_breaker(const circuit_breaker&) = delete;
+
+			~circuit_breaker() = default;
+
+			circuit_breaker& operator=(const circuit_breaker&) = delete;
+
+			permit acquire();
+			// must be called once for every granted permit
+			void release(const permit& call_permit, bool failed, const std::chrono::microseconds& duration);
+			circuit_breaker_statistics statistics() const;
+
+		private:
+			struct bucket {
+				std::int64_t second;
+				std::size_t calls;
+				std::size_t failures;
+			};
+
+			void open(const std::chrono::steady_clock::time_point& now);
+			bucket& current_bucket(std::int64_t second);
+
+		private:
+			circuit_breaker_settings settings;
+			mutable std::mutex mutex;
+			circuit_state state;
+			std::chrono::steady_clock::time_point opened_at;
+			std::uint64_t generation;
+			std::size_t probes_in_flight;
+			std::size_t probe_successes;
+			// one bucket per second of the window, reused round robin
+			std::vector<bucket> buckets;
+			circuit_breaker_statistics totals;
+	};
+
+}
+
+#endif // STEELBOX_CIRCUIT_BREAKER_H
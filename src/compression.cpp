@@ -0,0 +1,172 @@
+#include "compression.h"
+#include <limits>
+#include <stdexcept>
+#ifdef STEELBOX_WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef STEELBOX_WITH_ZSTD
+#include <zstd.h>
+#endif
+#include "exception.h"
+
+using namespace steelbox;
+
+namespace {
+
+	const std::size_t size_prefix_length = 4;
+	const std::string zstd_codec_name = "zstd";
+	const std::string lz4_codec_name = "lz4";
+
+}
+
+compression_codec steelbox::compression_codec_from_name(const std::string& name) {
+	if (name == zstd_codec_name) {
+		return compression_codec::zstd;
+	} else if (name == lz4_codec_name) {
+		return compression_codec::lz4;
+	}
+
+	throw std::invalid_argument{ "unknown compression codec " + name };
+}
+
+const std::string& steelbox::compression_codec_name(const compression_codec& codec) {
+	switch (codec) {
+		case compression_codec::zstd: {
+			return zstd_codec_name;
+		}
+		case compression_codec::lz4: {
+			return lz4_codec_name;
+		}
+	}
+
+	throw std::invalid_argument{ "unknown compression codec" };
+}
+
+bool steelbox::is_compression_codec_available(const compression_codec& codec) {
+	switch (codec) {
+		case compression_codec::zstd: {
+#ifdef STEELBOX_WITH_ZSTD
+			return true;
+#else
+			return false;
+#endif
+		}
+		case compression_codec::lz4: {
+#ifdef STEELBOX_WITH_LZ4
+			return true;
+#else
+			return false;
+#endif
+		}
+	}
+
+	return false;
+}
+
+std::vector<std::uint8_t> steelbox::compress(const compression_codec& codec, const std::uint8_t* data, std::size_t size, int level) {
+	if (size > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+		throw compression_exception{ "block is too large to compress" };
+	}
+
+	if (!is_compression_codec_available(codec)) {
+		throw compression_exception{ compression_codec_name(codec) + " support is not built in" };
+	}
+#if !defined(STEELBOX_WITH_ZSTD) && !defined(STEELBOX_WITH_LZ4)
+	(void)data;
+#endif
+#ifndef STEELBOX_WITH_ZSTD
+	(void)level;
+#endif
+
+	std::vector<std::uint8_t> block;
+	std::size_t compressed_size{ 0 };
+	switch (codec) {
+#ifdef STEELBOX_WITH_ZSTD
+		case compression_codec::zstd: {
+			block.resize(size_prefix_length + ZSTD_compressBound(size));
+			compressed_size = ZSTD_compress(block.data() + size_prefix_length, block.size() - size_prefix_length, data, size, level);
+			if (ZSTD_isError(compressed_size)) {
+				throw compression_exception{ ZSTD_getErrorName(compressed_size) };
+			}
+			break;
+		}
+#endif
+#ifdef STEELBOX_WITH_LZ4
+		case compression_codec::lz4: {
+			block.resize(size_prefix_length + static_cast<std::size_t>(LZ4_compressBound(static_cast<int>(size))));
+			const int result{ LZ4_compress_fast(
+				reinterpret_cast<const char*>(data),
+				reinterpret_cast<char*>(block.data() + size_prefix_length),
+				static_cast<int>(size),
+				static_cast<int>(block.size() - size_prefix_length),
+				1
+			) };
+			if (result <= 0) {
+				throw compression_exception{ "lz4 compression failed" };
+			}
+			compressed_size = static_cast<std::size_t>(result);
+			break;
+		}
+#endif
+		default: {
+			throw std::invalid_argument{ "unknown compression codec" };
+		}
+	}
+
+	for (std::size_t i = 0; i < size_prefix_length; ++i) {
+		block[i] = static_cast<std::uint8_t>((size >> (8 * i)) & 0xFF);
+	}
+	block.resize(size_prefix_length + compressed_size);
+
+	return block;
+}
+
+std::vector<std::uint8_t> steelbox::decompress(const compression_codec& codec, const std::uint8_t* data, std::size_t size) {
+	if (size < size_prefix_length) {
+		throw compression_exception{ "compressed block is too short" };
+	}
+
+	std::size_t decompressed_size{ 0 };
+	for (std::size_t i = 0; i < size_prefix_length; ++i) {
+		decompressed_size |= static_cast<std::size_t>(data[i]) << (8 * i);
+	}
+	if (decompressed_size > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+		throw compression_exception{ "compressed block is corrupt" };
+	}
+
+	if (!is_compression_codec_available(codec)) {
+		throw compression_exception{ compression_codec_name(codec) + " support is not built in" };
+	}
+
+	std::vector<std::uint8_t> block(decompressed_size);
+	switch (codec) {
+#ifdef STEELBOX_WITH_ZSTD
+		case compression_codec::zstd: {
+			const std::size_t result{ ZSTD_decompress(block.data(), block.size(), data + size_prefix_length, size - size_prefix_length) };
+			if (ZSTD_isError(result) || result != decompressed_size) {
+				throw compression_exception{ "compressed block is corrupt" };
+			}
+			break;
+		}
+#endif
+#ifdef STEELBOX_WITH_LZ4
+		case compression_codec::lz4: {
+			const int result{ LZ4_decompress_safe(
+				reinterpret_cast<const char*>(data + size_prefix_length),
+				reinterpret_cast<char*>(block.data()),
+				static_cast<int>(size - size_prefix_length),
+				static_cast<int>(block.size())
+			) };
+			if (result < 0 || static_cast<std::size_t>(result) != decompressed_size) {
+				throw compression_exception{ "compressed block is corrupt" };
+			}
+			break;
+		}
+#endif
+		default: {
+			throw std::invalid_argument{ "unknown compression codec" };
+		}
+	}
+
+	return block;
+}
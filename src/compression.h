@@ -0,0 +1,30 @@
+#ifndef STEELBOX_COMPRESSION_H
+#define STEELBOX_COMPRESSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace steelbox {
+
+	enum class compression_codec {
+		zstd,
+		lz4
+	};
+
+	compression_codec compression_codec_from_name(const std::string& name);
+	const std::string& compression_codec_name(const compression_codec& codec);
+	// false when steelbox was built without the library of the codec
+	bool is_compression_codec_available(const compression_codec& codec);
+
+	// The compressed block starts with the uncompressed size as a little-endian
+	// 32 bit integer so that both codecs can be decompressed in one allocation.
+	// level is the zstd level, 0 picks the default, lz4 always compresses at its default speed.
+	std::vector<std::uint8_t> compress(const compression_codec& codec, const std::uint8_t* data, std::size_t size, int level);
+	// throws compression_exception when the block is corrupt
+	std::vector<std::uint8_t> decompress(const compression_codec& codec, const std::uint8_t* data, std::size_t size);
+
+}
+
+#endif // STEELBOX_COMPRESSION_H
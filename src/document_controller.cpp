@@ -1,10 +1,18 @@
 #include "document_controller.h"
 #include <cassert>
+#include <future>
+#include <istream>
 #include <map>
+#include <ostream>
+#include <sstream>
+#include <utility>
 #include <boost/any.hpp>
 #include <steeljson/reader.h>
 #include <steeljson/writer.h>
+#include "body_streambuf.h"
 #include "exception.h"
+#include "json_writer.h"
+#include "utf8.h"
 
 using namespace steelbox;
 
@@ -13,7 +21,7 @@ document_controller::document_controller(
 	const std::unordered_map<std::string, entity_type_descriptor>& entity_types_map
 ) :
 	storage(storage),
-	entity_types_map(entity_types_map) {
+	entity_types_map(std::make_shared<const std::unordered_map<std::string, entity_type_descriptor>>(entity_types_map)) {
 	if (storage == nullptr) {
 		throw std::invalid_argument{ "storage must not be null" };
 	}
@@ -24,30 +32,44 @@ crow::response document_controller::get_document(
 	const std::string& entity_type_name,
 	const std::string& key_path
 ) const {
-	if (this->entity_types_map.count(entity_type_name) == 0) {
+	const std::shared_ptr<const std::unordered_map<std::string, entity_type_descriptor>> entity_types{ this->current_entity_types() };
+	if (entity_types->count(entity_type_name) == 0) {
 		return crow::response{ 404 };
 	}
 
 	std::unordered_map<std::string, const boost::any> key;
 	try {
-		this->build_entity_key_from_path(key_path, entity_type_name, key);
+		this->build_entity_key_from_path(key_path, entity_types->at(entity_type_name), key);
 	} catch (const invalid_key_path_exception&) {
 		return crow::response{ 404 };
 	} catch (const invalid_attribute_value_exception&) {
 		return crow::response{ 404 };
 	}
 
-	const std::vector<steeljson::value> result{ this->storage->get(username, entity_type_name, key) };
+	// concurrent gets of the same document share one storage read and its serialization
+	const std::shared_ptr<const std::string> body{ this->document_reads.run(
+		this->document_read_key(username, entity_type_name, entity_types->at(entity_type_name).key_identity(key)),
+		[&]() -> std::shared_ptr<const std::string> {
+			const std::vector<steeljson::value> result{ this->storage->get(username, entity_type_name, key) };
 
-	if (result.size() == 0) {
+			if (result.size() == 0) {
+				return nullptr;
+			}
+
+			assert(result.size() == 1);
+
+			body_streambuf body_buffer;
+			std::ostream body_stream{ &body_buffer };
+			write_json(body_stream, result[0]);
+			return std::make_shared<const std::string>(body_buffer.release());
+		}
+	) };
+
+	if (!body) {
 		return crow::response{ 404 };
 	}
 
-	assert(result.size() == 1);
-
-	std::ostringstream body_stream;
-	steeljson::write(body_stream, result[0]);
-	crow::response response{ 200, body_stream.str() };
+	crow::response response{ 200, *body };
 	response.set_header("Content-Type", "application/json");
 
 	return response;
@@ -56,10 +78,232 @@ crow::response document_controller::get_document(
 crow::response document_controller::get_documents(
 	const std::string& username,
 	const std::string& entity_type_name,
-	const std::string& filter
+	const std::string& key_path_prefix,
+	const std::string& cursor,
+	const std::string& limit
 ) const {
+	const std::shared_ptr<const std::unordered_map<std::string, entity_type_descriptor>> entity_types{ this->current_entity_types() };
+	if (entity_types->count(entity_type_name) == 0) {
+		return crow::response{ 404 };
+	}
+	const entity_type_descriptor& descriptor{ entity_types->at(entity_type_name) };
+
+	std::size_t page_size{ default_page_size };
+	if (!this->read_page_size(limit, max_page_size, page_size)) {
+		return crow::response{ 400 };
+	}
+
+	std::unordered_map<std::string, const boost::any> key_prefix;
+	try {
+		this->build_entity_key_prefix_from_path(key_path_prefix, descriptor, key_prefix);
+	} catch (const invalid_key_path_exception&) {
+		return crow::response{ 404 };
+	} catch (const invalid_attribute_value_exception&) {
+		return crow::response{ 404 };
+	}
+
+	std::vector<boost::any> after;
+	if (!cursor.empty()) {
+		try {
+			after = this->decode_cursor(cursor, descriptor, key_prefix.size());
+		} catch (const invalid_cursor_exception&) {
+			return crow::response{ 400 };
+		}
+	}
+
+	// one extra entity tells whether another page follows
+	std::vector<storages::entity> entities{ this->storage->list(username, entity_type_name, key_prefix, after, page_size + 1) };
+	const bool has_more{ entities.size() > page_size };
+	if (has_more) {
+		entities.pop_back();
+	}
+
+	steeljson::array page_entities;
+	for (const storages::entity& listed_entity : entities) {
+		steeljson::object page_entity;
+		page_entity.insert(steeljson::object::value_type{ "key", listed_entity.key });
+		page_entity.insert(steeljson::object::value_type{ "data", listed_entity.data });
+		page_entities.push_back(page_entity);
+	}
+
+	steeljson::object page;
+	page.insert(steeljson::object::value_type{ "entities", page_entities });
+	if (has_more) {
+		page.insert(steeljson::object::value_type{ "cursor", steeljson::value{ this->encode_cursor(entities.back().key, descriptor, key_prefix.size()) } });
+	} else {
+		page.insert(steeljson::object::value_type{ "cursor", steeljson::null });
+	}
+
+	body_streambuf body_buffer;
+	std::ostream body_stream{ &body_buffer };
+	write_json(body_stream, page);
+	crow::response response{ 200, body_buffer.release() };
+	response.set_header("Content-Type", "application/json");
+
+	return response;
+}
+
+crow::response document_controller::get_documents_by_key_paths(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::string& body
+) const {
+	const std::shared_ptr<const std::unordered_map<std::string, entity_type_descriptor>> entity_types{ this->current_entity_types() };
+	if (entity_types->count(entity_type_name) == 0) {
+		return crow::response{ 404 };
+	}
+	const entity_type_descriptor& descriptor{ entity_types->at(entity_type_name) };
+	if (!is_valid_utf8(body.data(), body.size())) {
+		return crow::response{ 400 };
+	}
+
+	std::vector<std::string> key_paths;
+	try {
+		input_streambuf body_buffer{ body.data(), body.size() };
+		std::istream body_stream{ &body_buffer };
+		const steeljson::value key_paths_value{ steeljson::read_document(body_stream) };
+		const steeljson::array& key_paths_array{ key_paths_value.as<const steeljson::array&>() };
 
-	return crow::response{ 404 };
+		for (std::size_t i = 0; i < key_paths_array.size(); ++i) {
+			key_paths.push_back(key_paths_array.at(i).as<const std::string&>());
+		}
+	} catch (...) {
+		return crow::response{ 400 };
+	}
+	if (key_paths.size() > max_page_size) {
+		return crow::response{ 400 };
+	}
+
+	// paths that are not valid keys can not match anything, like a GET of them
+	std::vector<std::string> valid_key_paths;
+	std::vector<std::unordered_map<std::string, const boost::any>> keys;
+	for (const std::string& key_path : key_paths) {
+		std::unordered_map<std::string, const boost::any> key;
+		try {
+			this->build_entity_key_from_path(key_path, descriptor, key);
+		} catch (const invalid_key_path_exception&) {
+			continue;
+		} catch (const invalid_attribute_value_exception&) {
+			continue;
+		}
+
+		valid_key_paths.push_back(key_path);
+		keys.push_back(std::move(key));
+	}
+
+	const std::vector<boost::optional<steeljson::value>> result{ this->storage->get_many(username, entity_type_name, keys) };
+
+	steeljson::object documents;
+	for (std::size_t i = 0; i < result.size(); ++i) {
+		if (result[i]) {
+			documents.insert(steeljson::object::value_type{ valid_key_paths[i], *result[i] });
+		}
+	}
+
+	body_streambuf body_buffer;
+	std::ostream body_stream{ &body_buffer };
+	write_json(body_stream, documents);
+	crow::response response{ 200, body_buffer.release() };
+	response.set_header("Content-Type", "application/json");
+
+	return response;
+}
+
+crow::response document_controller::query_documents(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::string& body,
+	const std::string& limit
+) const {
+	const std::shared_ptr<const std::unordered_map<std::string, entity_type_descriptor>> entity_types{ this->current_entity_types() };
+	if (entity_types->count(entity_type_name) == 0) {
+		return crow::response{ 404 };
+	}
+	const entity_type_descriptor& descriptor{ entity_types->at(entity_type_name) };
+
+	std::size_t page_size{ default_page_size };
+	if (!this->read_page_size(limit, max_page_size, page_size)) {
+		return crow::response{ 400 };
+	}
+
+	if (!is_valid_utf8(body.data(), body.size())) {
+		return crow::response{ 400 };
+	}
+
+	std::vector<storages::data_predicate> predicates;
+	try {
+		input_streambuf body_buffer{ body.data(), body.size() };
+		std::istream body_stream{ &body_buffer };
+		const steeljson::value filter_value{ steeljson::read_document(body_stream) };
+
+		for (const steeljson::object::value_type& condition : filter_value.as<const steeljson::object&>()) {
+			// only indexed paths are accepted so that no query scans the collection
+			const std::vector<entity_index_descriptor>::const_iterator index_it{ descriptor.find_index(condition.first) };
+			if (index_it == descriptor.indexes.cend()) {
+				return crow::response{ 400 };
+			}
+			const entity_attribute_descriptor value_descriptor{ index_it->path, index_it->type };
+
+			if (condition.second.type() != steeljson::value::type_t::object) {
+				storages::data_predicate predicate;
+				predicate.path = condition.first;
+				predicate.comparison = storages::comparison_operator::equal;
+				predicate.value = this->build_attribute_value(condition.second, value_descriptor);
+				predicates.push_back(predicate);
+				continue;
+			}
+
+			const steeljson::object& comparisons{ condition.second.as<const steeljson::object&>() };
+			if (comparisons.empty()) {
+				return crow::response{ 400 };
+			}
+			for (const steeljson::object::value_type& comparison : comparisons) {
+				storages::data_predicate predicate;
+				predicate.path = condition.first;
+				if (comparison.first == "eq") {
+					predicate.comparison = storages::comparison_operator::equal;
+				} else if (comparison.first == "gt") {
+					predicate.comparison = storages::comparison_operator::greater;
+				} else if (comparison.first == "gte") {
+					predicate.comparison = storages::comparison_operator::greater_or_equal;
+				} else if (comparison.first == "lt") {
+					predicate.comparison = storages::comparison_operator::less;
+				} else if (comparison.first == "lte") {
+					predicate.comparison = storages::comparison_operator::less_or_equal;
+				} else {
+					return crow::response{ 400 };
+				}
+				predicate.value = this->build_attribute_value(comparison.second, value_descriptor);
+				predicates.push_back(predicate);
+			}
+		}
+	} catch (...) {
+		return crow::response{ 400 };
+	}
+	if (predicates.empty()) {
+		return crow::response{ 400 };
+	}
+
+	const std::vector<storages::entity> entities{ this->storage->query(username, entity_type_name, predicates, page_size) };
+
+	steeljson::array found_entities;
+	for (const storages::entity& found_entity : entities) {
+		steeljson::object result_entity;
+		result_entity.insert(steeljson::object::value_type{ "key", found_entity.key });
+		result_entity.insert(steeljson::object::value_type{ "data", found_entity.data });
+		found_entities.push_back(result_entity);
+	}
+
+	steeljson::object result;
+	result.insert(steeljson::object::value_type{ "entities", found_entities });
+
+	body_streambuf body_buffer;
+	std::ostream body_stream{ &body_buffer };
+	write_json(body_stream, result);
+	crow::response response{ 200, body_buffer.release() };
+	response.set_header("Content-Type", "application/json");
+
+	return response;
 }
 
 crow::response document_controller::put_document(
@@ -68,18 +312,24 @@ crow::response document_controller::put_document(
 	const std::string& key_path,
 	const std::string& data
 ) {
-	if (this->entity_types_map.count(entity_type_name) == 0) {
+	const std::shared_ptr<const std::unordered_map<std::string, entity_type_descriptor>> entity_types{ this->current_entity_types() };
+	if (entity_types->count(entity_type_name) == 0) {
 		return crow::response{ 404 };
 	}
 
 	std::unordered_map<std::string, const boost::any> key;
 	try {
-		this->build_entity_key_from_path(key_path, entity_type_name, key);
+		this->build_entity_key_from_path(key_path, entity_types->at(entity_type_name), key);
 	} catch (const invalid_attribute_value_exception&) {
 		return crow::response{ 404 };
 	}
 
-	std::istringstream data_stream{ data };
+	if (!is_valid_utf8(data.data(), data.size())) {
+		return crow::response{ 400 };
+	}
+
+	input_streambuf data_buffer{ data.data(), data.size() };
+	std::istream data_stream{ &data_buffer };
 	steeljson::value data_value;
 	try {
 		data_value = steeljson::read_document(data_stream);
@@ -91,11 +341,273 @@ crow::response document_controller::put_document(
 		this->storage->put(username, entity_type_name, key, data_value);
 	} catch (const user_not_found_exception&) {
 		return crow::response{ 404 };
+	} catch (const duplicate_value_exception&) {
+		return crow::response{ 409 };
 	}
+	// a get in flight may have read the previous data, later gets must not join it
+	this->document_reads.forget(this->document_read_key(username, entity_type_name, entity_types->at(entity_type_name).key_identity(key)));
 
 	return crow::response{ 204 };
 }
 
+crow::response document_controller::export_documents(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::string& cursor,
+	const std::string& limit
+) const {
+	const std::shared_ptr<const std::unordered_map<std::string, entity_type_descriptor>> entity_types{ this->current_entity_types() };
+	if (!entity_type_name.empty() && entity_types->count(entity_type_name) == 0) {
+		return crow::response{ 404 };
+	}
+
+	std::size_t page_size{ default_export_page_size };
+	if (!this->read_page_size(limit, max_export_page_size, page_size)) {
+		return crow::response{ 400 };
+	}
+
+	std::string after_entity_type_name;
+	std::vector<boost::any> after;
+	if (!cursor.empty()) {
+		try {
+			after = this->decode_export_cursor(cursor, *entity_types, after_entity_type_name);
+		} catch (const invalid_cursor_exception&) {
+			return crow::response{ 400 };
+		}
+		if (!entity_type_name.empty() && after_entity_type_name != entity_type_name) {
+			return crow::response{ 400 };
+		}
+	}
+
+	body_streambuf body_buffer;
+	std::ostream body_stream{ &body_buffer };
+	std::size_t exported_count{ 0 };
+	std::string last_entity_type_name;
+	steeljson::value last_key{ steeljson::null };
+	try {
+		// one extra entity tells whether another page follows
+		this->storage->export_entities(
+			username,
+			entity_type_name,
+			after_entity_type_name,
+			after,
+			page_size + 1,
+			[&](const std::string& exported_entity_type_name, const steeljson::value& key, const steeljson::value& data) {
+				if (++exported_count > page_size) {
+					return;
+				}
+
+				body_stream << "{\"entity_type\":";
+				write_json(body_stream, steeljson::value{ exported_entity_type_name });
+				body_stream << ",\"key\":";
+				write_json(body_stream, key);
+				body_stream << ",\"data\":";
+				write_json(body_stream, data);
+				body_stream << "}\n";
+
+				last_entity_type_name = exported_entity_type_name;
+				last_key = key;
+			}
+		);
+	} catch (const user_not_found_exception&) {
+		return crow::response{ 404 };
+	}
+
+	crow::response response{ 200, body_buffer.release() };
+	response.set_header("Content-Type", "application/x-ndjson");
+	// crow cannot stream a body, so large exports are fetched page by page
+	if (exported_count > page_size && entity_types->count(last_entity_type_name) != 0) {
+		response.set_header(
+			"X-Export-Cursor",
+			this->encode_export_cursor(last_entity_type_name, last_key, entity_types->at(last_entity_type_name))
+		);
+	}
+
+	return response;
+}
+
+crow::response document_controller::import_documents(
+	const std::string& username,
+	const std::string& body
+) {
+	struct import_batch {
+		std::string entity_type_name;
+		std::vector<std::pair<std::unordered_map<std::string, const boost::any>, steeljson::value>> entities;
+		std::vector<std::size_t> lines;
+	};
+
+	const std::shared_ptr<const std::unordered_map<std::string, entity_type_descriptor>> entity_types{ this->current_entity_types() };
+	std::unordered_map<std::string, import_batch> pending_batches;
+	// declared before the future so that it outlives a write still running during unwinding
+	import_batch written_batch_lines;
+	std::future<void> written_batch;
+	std::size_t line_count{ 0 };
+	std::size_t imported_count{ 0 };
+	steeljson::array errors;
+
+	const auto report_error = [&errors](std::size_t line, const std::string& message) {
+		steeljson::object error;
+		error.insert(steeljson::object::value_type{ "line", steeljson::value{ static_cast<std::int64_t>(line) } });
+		error.insert(steeljson::object::value_type{ "error", steeljson::value{ message } });
+		errors.push_back(error);
+	};
+	// at most one batch is being written while the next one is parsed
+	const auto complete_written_batch = [&]() {
+		if (!written_batch.valid()) {
+			return;
+		}
+
+		try {
+			written_batch.get();
+			imported_count += written_batch_lines.lines.size();
+		} catch (const partial_write_exception& e) {
+			imported_count += written_batch_lines.lines.size() - e.failed_indexes().size();
+			for (std::size_t index : e.failed_indexes()) {
+				report_error(written_batch_lines.lines[index], "write failed");
+			}
+		} catch (const user_not_found_exception&) {
+			throw;
+		} catch (const storage_unavailable_exception&) {
+			throw;
+		} catch (...) {
+			for (std::size_t line : written_batch_lines.lines) {
+				report_error(line, "write failed");
+			}
+		}
+
+		// gets in flight may have read the previous data, later gets must not join them
+		const entity_type_descriptor& descriptor{ entity_types->at(written_batch_lines.entity_type_name) };
+		for (const std::pair<std::unordered_map<std::string, const boost::any>, steeljson::value>& entity : written_batch_lines.entities) {
+			this->document_reads.forget(this->document_read_key(username, written_batch_lines.entity_type_name, descriptor.key_identity(entity.first)));
+		}
+	};
+	const auto write_batch = [&](const std::string& entity_type_name, import_batch& batch) {
+		complete_written_batch();
+
+		written_batch_lines = std::move(batch);
+		written_batch_lines.entity_type_name = entity_type_name;
+		batch = import_batch();
+		storages::storage* const batch_storage{ this->storage };
+		const import_batch* const written{ &written_batch_lines };
+		written_batch = std::async(std::launch::async, [batch_storage, username, entity_type_name, written]() {
+			batch_storage->put_many(username, entity_type_name, written->entities);
+		});
+	};
+
+	try {
+		std::size_t line_begin{ 0 };
+		while (line_begin < body.size()) {
+			std::size_t line_end{ body.find('\n', line_begin) };
+			if (line_end == std::string::npos) {
+				line_end = body.size();
+			}
+			++line_count;
+
+			std::size_t line_size{ line_end - line_begin };
+			if (line_size > 0 && body[line_end - 1] == '\r') {
+				--line_size;
+			}
+			const std::size_t line_number{ line_count };
+			const std::size_t line_offset{ line_begin };
+			line_begin = line_end + 1;
+			if (line_size == 0) {
+				continue;
+			}
+
+			if (!is_valid_utf8(body.data() + line_offset, line_size)) {
+				report_error(line_number, "invalid UTF-8");
+				continue;
+			}
+
+			input_streambuf line_buffer{ body.data() + line_offset, line_size };
+			std::istream line_stream{ &line_buffer };
+			std::string entity_type_name;
+			std::unordered_map<std::string, const boost::any> key;
+			steeljson::value data;
+			try {
+				const steeljson::value line_value{ steeljson::read_document(line_stream) };
+				const steeljson::object& entity{ line_value.as<const steeljson::object&>() };
+
+				entity_type_name = entity.at("entity_type").as<const std::string&>();
+				if (entity_types->count(entity_type_name) == 0) {
+					report_error(line_number, "unknown entity type");
+					continue;
+				}
+				this->build_entity_key_from_object(entity.at("key"), entity_types->at(entity_type_name), key);
+				data = entity.at("data");
+			} catch (const invalid_attribute_value_exception&) {
+				report_error(line_number, "invalid key");
+				continue;
+			} catch (...) {
+				report_error(line_number, "invalid entity");
+				continue;
+			}
+
+			import_batch& batch{ pending_batches[entity_type_name] };
+			batch.entities.push_back(std::make_pair(std::move(key), std::move(data)));
+			batch.lines.push_back(line_number);
+			if (batch.entities.size() >= import_batch_size) {
+				write_batch(entity_type_name, batch);
+			}
+		}
+
+		for (std::unordered_map<std::string, import_batch>::value_type& batch : pending_batches) {
+			if (!batch.second.entities.empty()) {
+				write_batch(batch.first, batch.second);
+			}
+		}
+		complete_written_batch();
+	} catch (const user_not_found_exception&) {
+		return crow::response{ 404 };
+	}
+
+	steeljson::object summary;
+	summary.insert(steeljson::object::value_type{ "lines", steeljson::value{ static_cast<std::int64_t>(line_count) } });
+	summary.insert(steeljson::object::value_type{ "imported", steeljson::value{ static_cast<std::int64_t>(imported_count) } });
+	summary.insert(steeljson::object::value_type{ "failed", steeljson::value{ static_cast<std::int64_t>(errors.size()) } });
+	summary.insert(steeljson::object::value_type{ "errors", errors });
+
+	body_streambuf body_buffer;
+	std::ostream body_stream{ &body_buffer };
+	write_json(body_stream, summary);
+	crow::response response{ 200, body_buffer.release() };
+	response.set_header("Content-Type", "application/json");
+
+	return response;
+}
+
+bool document_controller::is_key_path_prefix(
+	const std::string& entity_type_name,
+	const std::string& key_path
+) const {
+	const std::shared_ptr<const std::unordered_map<std::string, entity_type_descriptor>> entity_types{ this->current_entity_types() };
+	const std::unordered_map<std::string, entity_type_descriptor>::const_iterator entity_type_it{
+		entity_types->find(entity_type_name)
+	};
+	if (entity_type_it == entity_types->cend()) {
+		return false;
+	}
+
+	return key_path.empty() || this->slash_count(key_path) + 1 < entity_type_it->second.key.size();
+}
+
+void document_controller::reconfigure(const std::unordered_map<std::string, entity_type_descriptor>& entity_types_map) {
+	std::atomic_store(
+		&this->entity_types_map,
+		std::shared_ptr<const std::unordered_map<std::string, entity_type_descriptor>>{
+			std::make_shared<const std::unordered_map<std::string, entity_type_descriptor>>(entity_types_map)
+		}
+	);
+}
+
+std::uint64_t document_controller::coalesced_reads() const {
+	return this->document_reads.shared_calls();
+}
+
+std::shared_ptr<const std::unordered_map<std::string, entity_type_descriptor>> document_controller::current_entity_types() const {
+	return std::atomic_load(&this->entity_types_map);
+}
+
 std::size_t document_controller::slash_count(const std::string& str) const {
 	std::size_t count{ 0 };
 
@@ -108,22 +620,87 @@ std::size_t document_controller::slash_count(const std::string& str) const {
 	return count;
 }
 
+void document_controller::build_entity_key_from_object(
+	const steeljson::value& key_value,
+	const entity_type_descriptor& descriptor,
+	std::unordered_map<std::string, const boost::any>& key
+) const {
+	if (key_value.type() != steeljson::value::type_t::object) {
+		throw invalid_attribute_value_exception();
+	}
+	const steeljson::object& key_object{ key_value.as<const steeljson::object&>() };
+	if (key_object.size() != descriptor.key.size()) {
+		throw invalid_attribute_value_exception();
+	}
+
+	for (const entity_attribute_descriptor& attribute_descriptor : descriptor.key) {
+		const steeljson::object::const_iterator attribute_it{ key_object.find(attribute_descriptor.name) };
+		if (attribute_it == key_object.end()) {
+			throw invalid_attribute_value_exception();
+		}
+
+		const boost::any value{ this->build_attribute_value(attribute_it->second, attribute_descriptor) };
+		if (attribute_descriptor.type == entity_attribute_type::string && boost::any_cast<const std::string&>(value).empty()) {
+			throw invalid_attribute_value_exception();
+		}
+		key.insert(std::make_pair(attribute_descriptor.name, value));
+	}
+}
+
+std::string document_controller::document_read_key(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::string& key_identity
+) const {
+	// length prefixes keep the key unambiguous whatever the parts contain, and the key identity
+	// makes differently spelled paths of one entity, like 007 and 7, share their flight
+	return std::to_string(username.size()) + ":" + username
+		+ std::to_string(entity_type_name.size()) + ":" + entity_type_name
+		+ key_identity;
+}
+
 void document_controller::build_entity_key_from_path(
 	const std::string& path,
-	const std::string& entity_type_name,
+	const entity_type_descriptor& descriptor,
 	std::unordered_map<std::string, const boost::any>& key
 ) const {
-	const entity_type_descriptor descriptor{ this->entity_types_map.at(entity_type_name) };
-
 	if (this->slash_count(path) != descriptor.key.size() - 1) {
 		throw invalid_key_path_exception();
 	}
 
-	std::istringstream source{ path };
+	this->parse_key_path(path, descriptor, descriptor.key.size(), key);
+}
+
+void document_controller::build_entity_key_prefix_from_path(
+	const std::string& path,
+	const entity_type_descriptor& descriptor,
+	std::unordered_map<std::string, const boost::any>& key
+) const {
+	const std::size_t attribute_count{ path.empty() ? 0 : this->slash_count(path) + 1 };
+
+	if (attribute_count >= descriptor.key.size()) {
+		throw invalid_key_path_exception();
+	}
+
+	this->parse_key_path(path, descriptor, attribute_count, key);
+}
+
+void document_controller::parse_key_path(
+	const std::string& path,
+	const entity_type_descriptor& descriptor,
+	std::size_t attribute_count,
+	std::unordered_map<std::string, const boost::any>& key
+) const {
 	std::string key_attribute_value_str;
+	std::size_t segment_begin{ 0 };
 
-	for (std::size_t i = 0; i < descriptor.key.size(); ++i) {
-		std::getline(source, key_attribute_value_str, '/');
+	for (std::size_t i = 0; i < attribute_count; ++i) {
+		std::size_t segment_end{ path.find('/', segment_begin) };
+		if (segment_end == std::string::npos) {
+			segment_end = path.size();
+		}
+		key_attribute_value_str.assign(path, segment_begin, segment_end - segment_begin);
+		segment_begin = segment_end + 1;
 		if (key_attribute_value_str.empty()) {
 			throw invalid_attribute_value_exception();
 		}
@@ -166,3 +743,214 @@ void document_controller::build_entity_key_from_path(
 		}
 	}
 }
+
+boost::any document_controller::build_attribute_value(
+	const steeljson::value& attribute_value,
+	const entity_attribute_descriptor& attribute_descriptor
+) const {
+	switch (attribute_descriptor.type) {
+		case entity_attribute_type::integer:
+		{
+			if (attribute_value.type() != steeljson::value::type_t::number || attribute_value.is<float>() || attribute_value.is<double>()) {
+				throw invalid_attribute_value_exception();
+			}
+
+			return boost::any(attribute_value.as<std::int64_t>());
+		}
+		case entity_attribute_type::floating_point:
+		{
+			if (attribute_value.type() != steeljson::value::type_t::number) {
+				throw invalid_attribute_value_exception();
+			}
+
+			if (attribute_value.is<float>() || attribute_value.is<double>()) {
+				return boost::any(static_cast<float>(attribute_value.as<double>()));
+			}
+			return boost::any(static_cast<float>(attribute_value.as<std::int64_t>()));
+		}
+		case entity_attribute_type::string:
+		{
+			if (attribute_value.type() != steeljson::value::type_t::string) {
+				throw invalid_attribute_value_exception();
+			}
+
+			return boost::any(attribute_value.as<const std::string&>());
+		}
+		default:
+		{
+			assert(false);
+			throw invalid_attribute_value_exception();
+		}
+	}
+}
+
+bool document_controller::read_page_size(const std::string& limit, std::size_t max_size, std::size_t& page_size) const {
+	if (limit.empty()) {
+		return true;
+	}
+
+	// std::stoll alone would accept leading blanks, a sign and trailing garbage like 10abc
+	for (char c : limit) {
+		if (c < '0' || c > '9') {
+			return false;
+		}
+	}
+
+	long long requested_page_size;
+	try {
+		requested_page_size = std::stoll(limit);
+	} catch (...) {
+		return false;
+	}
+	if (requested_page_size <= 0 || static_cast<unsigned long long>(requested_page_size) > max_size) {
+		return false;
+	}
+	page_size = static_cast<std::size_t>(requested_page_size);
+
+	return true;
+}
+
+std::string document_controller::encode_cursor(
+	const steeljson::value& key_value,
+	const entity_type_descriptor& descriptor,
+	std::size_t prefix_size
+) const {
+	const steeljson::object& key_object{ key_value.as<const steeljson::object&>() };
+	steeljson::array remaining_values;
+	for (std::size_t i = prefix_size; i < descriptor.key.size(); ++i) {
+		remaining_values.push_back(key_object.at(descriptor.key[i].name));
+	}
+
+	return this->write_cursor(remaining_values);
+}
+
+std::vector<boost::any> document_controller::decode_cursor(
+	const std::string& cursor,
+	const entity_type_descriptor& descriptor,
+	std::size_t prefix_size
+) const {
+	std::vector<boost::any> after;
+	try {
+		const steeljson::value remaining_values_value{ this->read_cursor(cursor) };
+		const steeljson::array& remaining_values{ remaining_values_value.as<const steeljson::array&>() };
+		if (remaining_values.size() != descriptor.key.size() - prefix_size) {
+			throw invalid_cursor_exception();
+		}
+
+		for (std::size_t i = 0; i < remaining_values.size(); ++i) {
+			after.push_back(this->build_attribute_value(remaining_values.at(i), descriptor.key[prefix_size + i]));
+		}
+	} catch (const invalid_cursor_exception&) {
+		throw;
+	} catch (...) {
+		throw invalid_cursor_exception();
+	}
+
+	return after;
+}
+
+std::string document_controller::encode_export_cursor(
+	const std::string& entity_type_name,
+	const steeljson::value& key_value,
+	const entity_type_descriptor& descriptor
+) const {
+	const steeljson::object& key_object{ key_value.as<const steeljson::object&>() };
+	steeljson::array position;
+	position.push_back(steeljson::value{ entity_type_name });
+	for (const entity_attribute_descriptor& attribute_descriptor : descriptor.key) {
+		position.push_back(key_object.at(attribute_descriptor.name));
+	}
+
+	return this->write_cursor(position);
+}
+
+std::vector<boost::any> document_controller::decode_export_cursor(
+	const std::string& cursor,
+	const std::unordered_map<std::string, entity_type_descriptor>& entity_types,
+	std::string& entity_type_name
+) const {
+	std::vector<boost::any> after;
+	try {
+		const steeljson::value position_value{ this->read_cursor(cursor) };
+		const steeljson::array& position{ position_value.as<const steeljson::array&>() };
+		if (position.empty()) {
+			throw invalid_cursor_exception();
+		}
+
+		entity_type_name = position.at(0).as<const std::string&>();
+		const std::unordered_map<std::string, entity_type_descriptor>::const_iterator entity_type_it{ entity_types.find(entity_type_name) };
+		if (entity_type_it == entity_types.cend() || position.size() != entity_type_it->second.key.size() + 1) {
+			throw invalid_cursor_exception();
+		}
+
+		for (std::size_t i = 1; i < position.size(); ++i) {
+			after.push_back(this->build_attribute_value(position.at(i), entity_type_it->second.key[i - 1]));
+		}
+	} catch (const invalid_cursor_exception&) {
+		throw;
+	} catch (...) {
+		throw invalid_cursor_exception();
+	}
+
+	return after;
+}
+
+std::string document_controller::write_cursor(const steeljson::value& position) const {
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+	std::ostringstream cursor_stream;
+	steeljson::write(cursor_stream, position);
+	const std::string plain{ cursor_stream.str() };
+
+	// unpadded base64url keeps the cursor opaque and safe to pass in a query string
+	std::string cursor;
+	std::uint32_t bits{ 0 };
+	int bit_count{ 0 };
+	for (unsigned char c : plain) {
+		bits = (bits << 8) | c;
+		bit_count += 8;
+		while (bit_count >= 6) {
+			bit_count -= 6;
+			cursor.push_back(alphabet[(bits >> bit_count) & 0x3F]);
+		}
+	}
+	if (bit_count > 0) {
+		cursor.push_back(alphabet[(bits << (6 - bit_count)) & 0x3F]);
+	}
+
+	return cursor;
+}
+
+steeljson::value document_controller::read_cursor(const std::string& cursor) const {
+	std::string plain;
+	std::uint32_t bits{ 0 };
+	int bit_count{ 0 };
+	for (char c : cursor) {
+		std::uint32_t sextet;
+		if (c >= 'A' && c <= 'Z') {
+			sextet = c - 'A';
+		} else if (c >= 'a' && c <= 'z') {
+			sextet = c - 'a' + 26;
+		} else if (c >= '0' && c <= '9') {
+			sextet = c - '0' + 52;
+		} else if (c == '-') {
+			sextet = 62;
+		} else if (c == '_') {
+			sextet = 63;
+		} else {
+			throw invalid_cursor_exception();
+		}
+
+		bits = (bits << 6) | sextet;
+		bit_count += 6;
+		if (bit_count >= 8) {
+			bit_count -= 8;
+			plain.push_back(static_cast<char>((bits >> bit_count) & 0xFF));
+		}
+	}
+
+	input_streambuf plain_buffer{ plain.data(), plain.size() };
+	std::istream plain_stream{ &plain_buffer };
+
+	return steeljson::read_document(plain_stream);
+}
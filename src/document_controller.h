@@ -1,13 +1,22 @@
 #ifndef STEELBOX_DOCUMENT_CONTROLLER_H
 #define STEELBOX_DOCUMENT_CONTROLLER_H
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <crow/http_response.h>
 #include "entity_type.h"
+#include "single_flight.h"
 #include "storages/storage.h"
 
 namespace steelbox {
 
+	const std::size_t import_batch_size = 1000;
+	const std::size_t default_page_size = 100;
+	const std::size_t max_page_size = 1000;
+	const std::size_t default_export_page_size = 10000;
+	const std::size_t max_export_page_size = 100000;
+
 	class document_controller {
 		public:
 			document_controller(
@@ -26,10 +35,28 @@ namespace steelbox {
 				const std::string& entity_type_name,
 				const std::string& key_path
 			) const;
+			// lists the entities whose leading key attributes are given by key_path_prefix,
+			// a page ends with a cursor to pass back when more entities follow
 			crow::response get_documents(
 				const std::string& username,
 				const std::string& entity_type_name,
-				const std::string& filter
+				const std::string& key_path_prefix,
+				const std::string& cursor,
+				const std::string& limit
+			) const;
+			// body is a JSON array of key paths, the response maps each found key path to its data
+			crow::response get_documents_by_key_paths(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::string& body
+			) const;
+			// body maps indexed data paths to a value or to an object of
+			// "eq", "gt", "gte", "lt" and "lte" comparisons
+			crow::response query_documents(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::string& body,
+				const std::string& limit
 			) const;
 			crow::response put_document(
 				const std::string& username,
@@ -37,18 +64,94 @@ namespace steelbox {
 				const std::string& key_path,
 				const std::string& data
 			);
+			// entity_type_name may be empty to export entities of every type, the X-Export-Cursor
+			// header of a page is passed back as cursor when more entities follow
+			crow::response export_documents(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::string& cursor,
+				const std::string& limit
+			) const;
+			// body holds one {"entity_type", "key", "data"} object per line, as produced by export_documents
+			crow::response import_documents(
+				const std::string& username,
+				const std::string& body
+			);
+
+			// requests already running keep the entity types they started with
+			void reconfigure(const std::unordered_map<std::string, entity_type_descriptor>& entity_types_map);
+
+			bool is_key_path_prefix(
+				const std::string& entity_type_name,
+				const std::string& key_path
+			) const;
+			// reads answered by sharing the result of an identical read already in flight
+			std::uint64_t coalesced_reads() const;
 
 		private:
 			std::size_t slash_count(const std::string&) const;
+			std::shared_ptr<const std::unordered_map<std::string, entity_type_descriptor>> current_entity_types() const;
 			void build_entity_key_from_path(
 				const std::string&,
+				const entity_type_descriptor&,
+				std::unordered_map<std::string, const boost::any>&
+			) const;
+			void build_entity_key_prefix_from_path(
 				const std::string&,
+				const entity_type_descriptor&,
 				std::unordered_map<std::string, const boost::any>&
 			) const;
+			void parse_key_path(
+				const std::string&,
+				const entity_type_descriptor&,
+				std::size_t,
+				std::unordered_map<std::string, const boost::any>&
+			) const;
+			boost::any build_attribute_value(
+				const steeljson::value&,
+				const entity_attribute_descriptor&
+			) const;
+			// keeps page_size when limit is empty, false when limit is not a count between one and the maximum
+			bool read_page_size(const std::string&, std::size_t, std::size_t&) const;
+			std::string encode_cursor(
+				const steeljson::value&,
+				const entity_type_descriptor&,
+				std::size_t
+			) const;
+			std::vector<boost::any> decode_cursor(
+				const std::string&,
+				const entity_type_descriptor&,
+				std::size_t
+			) const;
+			std::string encode_export_cursor(
+				const std::string&,
+				const steeljson::value&,
+				const entity_type_descriptor&
+			) const;
+			std::vector<boost::any> decode_export_cursor(
+				const std::string&,
+				const std::unordered_map<std::string, entity_type_descriptor>&,
+				std::string&
+			) const;
+			std::string write_cursor(const steeljson::value&) const;
+			steeljson::value read_cursor(const std::string&) const;
+			void build_entity_key_from_object(
+				const steeljson::value&,
+				const entity_type_descriptor&,
+				std::unordered_map<std::string, const boost::any>&
+			) const;
+			std::string document_read_key(
+				const std::string&,
+				const std::string&,
+				const std::string&
+			) const;
 
 		private:
 			steelbox::storages::storage* storage;
-			std::unordered_map<std::string, entity_type_descriptor> entity_types_map;
+			// read with std::atomic_load, replaced by reconfigure
+			std::shared_ptr<const std::unordered_map<std::string, entity_type_descriptor>> entity_types_map;
+			// serialized documents of the gets in flight, null when not found
+			mutable single_flight<std::shared_ptr<const std::string>> document_reads;
 	};
 
 }
@@ -1,11 +1,23 @@
 #include "entity_type.h"
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include "exception.h"
 
 using namespace steelbox;
 
-entity_type_descriptor::entity_type_descriptor(const std::vector<entity_attribute_descriptor>& key) :
-	key(key) {
+entity_type_descriptor::entity_type_descriptor(
+	const std::vector<entity_attribute_descriptor>& key,
+	const durability_level& durability,
+	const std::vector<entity_index_descriptor>& indexes,
+	const std::chrono::seconds& time_to_live,
+	std::size_t max_entities_per_user
+) :
+	key(key),
+	durability(durability),
+	indexes(indexes),
+	time_to_live(time_to_live),
+	max_entities_per_user(max_entities_per_user) {
 	for (std::size_t i = 0; i < this->key.size(); ++i) {
 		for (std::size_t j = i + 1; j < this->key.size(); ++j) {
 			if (this->key[i].name == this->key[j].name) {
@@ -13,12 +25,78 @@ entity_type_descriptor::entity_type_descriptor(const std::vector<entity_attribut
 			}
 		}
 	}
+
+	for (std::size_t i = 0; i < this->indexes.size(); ++i) {
+		const std::string& path{ this->indexes[i].path };
+		if (path.empty() || path.front() == '.' || path.back() == '.' || path.find("..") != std::string::npos || path.find('$') != std::string::npos) {
+			throw std::invalid_argument{ "invalid index path" };
+		}
+		for (std::size_t j = i + 1; j < this->indexes.size(); ++j) {
+			if (path == this->indexes[j].path) {
+				throw std::invalid_argument{ "indexes must have unique paths" };
+			}
+		}
+	}
+
+	if (this->time_to_live.count() < 0) {
+		throw std::invalid_argument{ "time to live must not be negative" };
+	}
+}
+
+std::vector<entity_index_descriptor>::const_iterator entity_type_descriptor::find_index(const std::string& path) const {
+	std::vector<entity_index_descriptor>::const_iterator ci{ this->indexes.cbegin() };
+
+	for (; ci != this->indexes.cend(); ++ci) {
+		if (ci->path == path) {
+			return ci;
+		}
+	}
+
+	return ci;
+}
+
+std::string entity_type_descriptor::key_identity(const std::unordered_map<std::string, const boost::any>& entity_key) const {
+	std::string identity;
+
+	for (const entity_attribute_descriptor& attribute_descriptor : this->key) {
+		const boost::any& value{ entity_key.at(attribute_descriptor.name) };
+
+		switch (attribute_descriptor.type) {
+			case entity_attribute_type::integer: {
+				identity += std::to_string(boost::any_cast<std::int64_t>(value));
+				break;
+			}
+			case entity_attribute_type::floating_point: {
+				// keys are stored as doubles, so compare their bit patterns
+				const double floating_point_value{ boost::any_cast<float>(value) };
+				char bytes[sizeof(double)];
+				std::memcpy(bytes, &floating_point_value, sizeof(double));
+				identity.append(bytes, sizeof(double));
+				break;
+			}
+			case entity_attribute_type::string: {
+				const std::string& string_value{ boost::any_cast<const std::string&>(value) };
+				identity += std::to_string(string_value.size());
+				identity += ':';
+				identity += string_value;
+				break;
+			}
+		}
+		identity += '/';
+	}
+
+	return identity;
 }
 
 std::unordered_map<std::string, entity_type_descriptor> steelbox::read_entity_types_descriptors(const steeljson::object& entity_types_config) {
 	std::unordered_map<std::string, entity_type_descriptor> entity_types_map;
 
 	for (const steeljson::object::value_type& entity_type : entity_types_config) {
+		// names starting with an underscore are reserved for the service endpoints
+		if (entity_type.first.empty() || entity_type.first[0] == '_') {
+			throw configuration_exception{ "invalid entity type name" };
+		}
+
 		try {
 			const steeljson::object& entity_type_descriptor_object{ entity_type.second.as<const steeljson::object&>() };
 			const steeljson::array& key_attribute_descriptors{ entity_type_descriptor_object.at("key").as<const steeljson::array&>() };
@@ -48,7 +126,73 @@ std::unordered_map<std::string, entity_type_descriptor> steelbox::read_entity_ty
 				}
 			}
 
-			entity_types_map.insert(std::make_pair(entity_type.first, entity_type_descriptor(key)));
+			durability_level durability{ durability_level::inherited };
+			if (entity_type_descriptor_object.find("durability") != entity_type_descriptor_object.end()) {
+				const std::string& durability_name{ entity_type_descriptor_object.at("durability").as<const std::string&>() };
+
+				if (durability_name == "default") {
+					durability = durability_level::inherited;
+				} else if (durability_name == "unacknowledged") {
+					durability = durability_level::unacknowledged;
+				} else if (durability_name == "acknowledged") {
+					durability = durability_level::acknowledged;
+				} else if (durability_name == "majority") {
+					durability = durability_level::majority;
+				} else if (durability_name == "journaled") {
+					durability = durability_level::journaled;
+				} else {
+					throw configuration_exception{ "unknown durability level" };
+				}
+			}
+
+			std::vector<entity_index_descriptor> indexes;
+			if (entity_type_descriptor_object.find("indexes") != entity_type_descriptor_object.end()) {
+				for (const steeljson::array::value_type& index_descriptor : entity_type_descriptor_object.at("indexes").as<const steeljson::array&>()) {
+					const steeljson::object& index_descriptor_object{ index_descriptor.as<const steeljson::object&>() };
+					const std::string& index_type_name{ index_descriptor_object.at("type").as<const std::string&>() };
+
+					entity_attribute_type index_type;
+					if (index_type_name == "integer") {
+						index_type = entity_attribute_type::integer;
+					} else if (index_type_name == "float") {
+						index_type = entity_attribute_type::floating_point;
+					} else if (index_type_name == "string") {
+						index_type = entity_attribute_type::string;
+					} else {
+						throw configuration_exception{ "unknown index type" };
+					}
+
+					bool unique{ false };
+					if (index_descriptor_object.find("unique") != index_descriptor_object.end()) {
+						unique = index_descriptor_object.at("unique").as<bool>();
+					}
+
+					indexes.push_back(entity_index_descriptor(
+						index_descriptor_object.at("path").as<const std::string&>(),
+						index_type,
+						unique
+					));
+				}
+			}
+
+			std::chrono::seconds time_to_live{ 0 };
+			if (entity_type_descriptor_object.find("time_to_live") != entity_type_descriptor_object.end()) {
+				time_to_live = std::chrono::seconds{ entity_type_descriptor_object.at("time_to_live").as<std::int64_t>() };
+				if (time_to_live.count() <= 0) {
+					throw configuration_exception{ "time to live must be positive" };
+				}
+			}
+
+			std::size_t max_entities_per_user{ 0 };
+			if (entity_type_descriptor_object.find("max_entities_per_user") != entity_type_descriptor_object.end()) {
+				const std::int64_t max_entities{ entity_type_descriptor_object.at("max_entities_per_user").as<std::int64_t>() };
+				if (max_entities <= 0) {
+					throw configuration_exception{ "maximum number of entities per user must be positive" };
+				}
+				max_entities_per_user = static_cast<std::size_t>(max_entities);
+			}
+
+			entity_types_map.insert(std::make_pair(entity_type.first, entity_type_descriptor(key, durability, indexes, time_to_live, max_entities_per_user)));
 		} catch (...) {
 			throw configuration_exception{ "invalid entity type configuration" };
 		}
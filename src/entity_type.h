@@ -1,8 +1,12 @@
 #ifndef STEELBOX_ENTITY_TYPE_H
 #define STEELBOX_ENTITY_TYPE_H
 
+#include <chrono>
+#include <cstddef>
 #include <string>
+#include <unordered_map>
 #include <vector>
+#include <boost/any.hpp>
 #include <steeljson/value.h>
 
 namespace steelbox {
@@ -22,10 +26,47 @@ namespace steelbox {
 		entity_attribute_type type;
 	};
 
+	// index on a path inside the entity data, unique indexes are unique per user
+	struct entity_index_descriptor {
+		entity_index_descriptor(const std::string& path, const entity_attribute_type& type, bool unique) :
+			path(path),
+			type(type),
+			unique(unique) { }
+
+		std::string path;
+		entity_attribute_type type;
+		bool unique;
+	};
+
+	enum class durability_level {
+		// the write concern of the storage uri, or the server default without one
+		inherited,
+		unacknowledged,
+		acknowledged,
+		majority,
+		journaled
+	};
+
 	struct entity_type_descriptor {
-		entity_type_descriptor(const std::vector<entity_attribute_descriptor>& key);
+		entity_type_descriptor(
+			const std::vector<entity_attribute_descriptor>& key,
+			const durability_level& durability = durability_level::inherited,
+			const std::vector<entity_index_descriptor>& indexes = { },
+			const std::chrono::seconds& time_to_live = std::chrono::seconds{ 0 },
+			std::size_t max_entities_per_user = 0
+		);
 
 		std::vector<entity_attribute_descriptor> key;
+		durability_level durability;
+		std::vector<entity_index_descriptor> indexes;
+		// entities not written for this long are removed, zero keeps them forever
+		std::chrono::seconds time_to_live;
+		// the least recently written entities of a user above this many are removed, zero for no limit
+		std::size_t max_entities_per_user;
+
+		std::vector<entity_index_descriptor>::const_iterator find_index(const std::string& path) const;
+		// equal for keys that denote the same entity, however their values were spelled
+		std::string key_identity(const std::unordered_map<std::string, const boost::any>& entity_key) const;
 	};
 
 	std::unordered_map<std::string, entity_type_descriptor> read_entity_types_descriptors(const steeljson::object& entity_types_config);
@@ -1,8 +1,11 @@
 #ifndef STEELBOX_EXCEPTION_H
 #define STEELBOX_EXCEPTION_H
 
+#include <chrono>
+#include <cstddef>
 #include <exception>
 #include <string>
+#include <vector>
 
 namespace steelbox {
 
@@ -42,6 +45,16 @@ namespace steelbox {
 			~invalid_key_path_exception() = default;
 	};
 
+	class invalid_cursor_exception : public exception {
+		public:
+			invalid_cursor_exception() = default;
+			invalid_cursor_exception(const std::string& msg)
+				: exception(msg) {
+			}
+
+			~invalid_cursor_exception() = default;
+	};
+
 	class user_not_found_exception : public exception {
 		public:
 			user_not_found_exception() = default;
@@ -52,6 +65,55 @@ namespace steelbox {
 			~user_not_found_exception() = default;
 	};
 
+	class duplicate_value_exception : public exception {
+		public:
+			duplicate_value_exception() = default;
+			duplicate_value_exception(const std::string& msg)
+				: exception(msg) {
+			}
+
+			~duplicate_value_exception() = default;
+	};
+
+	// some writes of a batch were rejected, the others were applied
+	class partial_write_exception : public exception {
+		public:
+			partial_write_exception() = default;
+			partial_write_exception(const std::string& msg, const std::vector<std::size_t>& failed_indexes)
+				: exception(msg), failed(failed_indexes) {
+			}
+
+			~partial_write_exception() = default;
+
+			// positions of the rejected writes in the batch
+			const std::vector<std::size_t>& failed_indexes() const {
+				return this->failed;
+			}
+
+		private:
+			std::vector<std::size_t> failed;
+	};
+
+	class traffic_log_exception : public exception {
+		public:
+			traffic_log_exception() = default;
+			traffic_log_exception(const std::string& msg)
+				: exception(msg) {
+			}
+
+			~traffic_log_exception() = default;
+	};
+
+	class compression_exception : public exception {
+		public:
+			compression_exception() = default;
+			compression_exception(const std::string& msg)
+				: exception(msg) {
+			}
+
+			~compression_exception() = default;
+	};
+
 	class configuration_exception : public exception {
 		public:
 			configuration_exception() = default;
@@ -72,6 +134,24 @@ namespace steelbox {
 			~storage_exception() = default;
 	};
 
+	// the storage rejected the operation without trying it, see retry_after
+	class storage_unavailable_exception : public storage_exception {
+		public:
+			storage_unavailable_exception() = default;
+			storage_unavailable_exception(const std::string& msg, const std::chrono::milliseconds& retry_after)
+				: storage_exception(msg), retry_after_duration(retry_after) {
+			}
+
+			~storage_unavailable_exception() = default;
+
+			const std::chrono::milliseconds& retry_after() const {
+				return this->retry_after_duration;
+			}
+
+		private:
+			std::chrono::milliseconds retry_after_duration{ 0 };
+	};
+
 }
 
 #endif // STEELBOX_EXCEPTION_H
@@ -0,0 +1,116 @@
+#include "json_writer.h"
+#include <cassert>
+#include <string>
+#include <steeljson/writer.h>
+#include "utf8.h"
+
+using namespace steelbox;
+
+namespace {
+
+	void write_json_string(std::ostream& stream, const std::string& str) {
+		static const char hex_digits[] = "0123456789abcdef";
+
+		const char* data{ str.data() };
+		std::size_t remaining{ str.size() };
+
+		stream.put('"');
+		while (remaining > 0) {
+			const std::size_t run{ find_json_escape(data, remaining) };
+			stream.write(data, static_cast<std::streamsize>(run));
+			if (run == remaining) {
+				break;
+			}
+
+			const unsigned char escaped{ static_cast<unsigned char>(data[run]) };
+			switch (escaped) {
+				case '"': {
+					stream.write("\\\"", 2);
+					break;
+				}
+				case '\\': {
+					stream.write("\\\\", 2);
+					break;
+				}
+				case '\b': {
+					stream.write("\\b", 2);
+					break;
+				}
+				case '\f': {
+					stream.write("\\f", 2);
+					break;
+				}
+				case '\n': {
+					stream.write("\\n", 2);
+					break;
+				}
+				case '\r': {
+					stream.write("\\r", 2);
+					break;
+				}
+				case '\t': {
+					stream.write("\\t", 2);
+					break;
+				}
+				default: {
+					const char unicode_escape[] = { '\\', 'u', '0', '0', hex_digits[escaped >> 4], hex_digits[escaped & 0x0F] };
+					stream.write(unicode_escape, sizeof(unicode_escape));
+					break;
+				}
+			}
+
+			data += run + 1;
+			remaining -= run + 1;
+		}
+		stream.put('"');
+	}
+
+}
+
+void steelbox::write_json(std::ostream& stream, const steeljson::value& value) {
+	switch (value.type()) {
+		case steeljson::value::type_t::null:
+		case steeljson::value::type_t::boolean:
+		case steeljson::value::type_t::number: {
+			steeljson::write(stream, value);
+			break;
+		}
+		case steeljson::value::type_t::string: {
+			write_json_string(stream, value.as<const std::string&>());
+			break;
+		}
+		case steeljson::value::type_t::array: {
+			const steeljson::array& array{ value.as<const steeljson::array&>() };
+
+			stream.put('[');
+			for (std::size_t i = 0; i < array.size(); ++i) {
+				if (i > 0) {
+					stream.put(',');
+				}
+				write_json(stream, array.at(i));
+			}
+			stream.put(']');
+			break;
+		}
+		case steeljson::value::type_t::object: {
+			bool first{ true };
+
+			stream.put('{');
+			for (const steeljson::object::value_type& member : value.as<const steeljson::object&>()) {
+				if (!first) {
+					stream.put(',');
+				}
+				first = false;
+
+				write_json_string(stream, member.first);
+				stream.put(':');
+				write_json(stream, member.second);
+			}
+			stream.put('}');
+			break;
+		}
+		default: {
+			assert(false);
+		}
+	}
+}
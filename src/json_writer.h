@@ -0,0 +1,15 @@
+#ifndef STEELBOX_JSON_WRITER_H
+#define STEELBOX_JSON_WRITER_H
+
+#include <ostream>
+#include <steeljson/value.h>
+
+namespace steelbox {
+
+	// Writes compact JSON. Strings are copied in runs between the bytes that need
+	// escaping, scalars other than strings are written by steeljson.
+	void write_json(std::ostream& stream, const steeljson::value& value);
+
+}
+
+#endif // STEELBOX_JSON_WRITER_H
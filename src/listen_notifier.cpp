@@ -0,0 +1,83 @@
+#include "listen_notifier.h"
+#include <atomic>
+#include <mutex>
+#ifdef __linux__
+#include <cerrno>
+#include <dlfcn.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+using namespace steelbox;
+
+namespace {
+
+	std::atomic<std::uint16_t> listen_port{ 0 };
+	std::mutex listen_mutex;
+	std::function<void()> listen_notification;
+
+}
+
+void steelbox::notify_on_listen(std::uint16_t port, const std::function<void()>& notify) {
+#ifdef __linux__
+	std::lock_guard<std::mutex> lock{ listen_mutex };
+	listen_notification = port != 0 ? notify : std::function<void()>{ };
+	listen_port.store(port);
+#else
+	if (port != 0 && notify) {
+		notify();
+	}
+#endif
+}
+
+#ifdef __linux__
+
+// takes precedence over the listen of the C library, which is called through dlsym
+extern "C" int listen(int socket, int backlog) {
+	using listen_function = int (*)(int, int);
+	static const listen_function system_listen{ reinterpret_cast<listen_function>(dlsym(RTLD_NEXT, "listen")) };
+	if (system_listen == nullptr) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	const int result{ system_listen(socket, backlog) };
+	const std::uint16_t port{ listen_port.load() };
+	if (result != 0 || port == 0) {
+		return result;
+	}
+
+	sockaddr_storage address;
+	socklen_t address_length{ sizeof(address) };
+	const int saved_errno{ errno };
+	if (::getsockname(socket, reinterpret_cast<sockaddr*>(&address), &address_length) != 0) {
+		errno = saved_errno;
+		return result;
+	}
+
+	std::uint16_t listening_port{ 0 };
+	if (address.ss_family == AF_INET) {
+		listening_port = ntohs(reinterpret_cast<const sockaddr_in*>(&address)->sin_port);
+	} else if (address.ss_family == AF_INET6) {
+		listening_port = ntohs(reinterpret_cast<const sockaddr_in6*>(&address)->sin6_port);
+	}
+	if (listening_port != port) {
+		return result;
+	}
+
+	std::function<void()> notify;
+	{
+		std::lock_guard<std::mutex> lock{ listen_mutex };
+		if (listen_port.load() == port) {
+			notify.swap(listen_notification);
+			listen_port.store(0);
+		}
+	}
+	if (notify) {
+		notify();
+	}
+
+	return result;
+}
+
+#endif
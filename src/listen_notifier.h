@@ -0,0 +1,17 @@
+#ifndef STEELBOX_LISTEN_NOTIFIER_H
+#define STEELBOX_LISTEN_NOTIFIER_H
+
+#include <cstdint>
+#include <functional>
+
+namespace steelbox {
+
+	// Calls notify once, on the thread calling listen(2), when a socket bound to port starts
+	// listening, a port of zero drops a notification still pending. crow creates its acceptor
+	// itself without telling when it accepts connections, so this is done by wrapping listen(2)
+	// and only available on Linux, elsewhere notify is called right away.
+	void notify_on_listen(std::uint16_t port, const std::function<void()>& notify);
+
+}
+
+#endif // STEELBOX_LISTEN_NOTIFIER_H
@@ -1,56 +1,515 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <signal.h>
+#include <unistd.h>
 #include <crow/app.h>
 #include <steeljson/reader.h>
+#include <steeljson/writer.h>
+#include "body_streambuf.h"
 #include "document_controller.h"
 #include "entity_type.h"
+#include "exception.h"
+#include "listen_notifier.h"
+#include "reuse_port.h"
+#include "signal_listener.h"
+#include "traffic_capture.h"
+#include "worker_launcher.h"
+#include "storages/guarded_storage.h"
 #include "storages/mongodb/storage.h"
 
 using namespace steelbox;
 
-int main(int, char**) {
-	steeljson::object config;
-	steeljson::object storages_config;
-	steeljson::object storage_config;
-	std::unordered_map<std::string, entity_type_descriptor> entity_type_descriptors;
+namespace {
 
-	try {
-		std::ifstream ifs{ "config.json" };
-		config = steeljson::read_document(ifs).as<const steeljson::object&>();
-		storages_config = config.at("storages").as<const steeljson::object&>();
-		storage_config = storages_config.at("main").as<const steeljson::object&>();
-		entity_type_descriptors = read_entity_types_descriptors(config.at("entity_types").as<const steeljson::object&>());
-	} catch (...) {
-		std::cerr << "invalid configuration file" << std::endl;
-		return 1;
+	const std::uint16_t server_port = 31700;
+
+	struct warmup_document {
+		std::string username;
+		std::string entity_type_name;
+		std::string key_path;
+	};
+
+	// what is fetched before the server reports itself ready
+	struct warmup_settings {
+		warmup_settings() :
+			enabled(false),
+			connections(0) {
+		}
+
+		bool enabled;
+		// pooled connections opened at once, the users and documents are fetched on as many threads
+		std::size_t connections;
+		std::vector<std::string> users;
+		std::vector<warmup_document> documents;
+	};
+
+	// documents are given as their path below the server root, username/entity_type/key_path
+	warmup_document read_warmup_document(const std::string& path) {
+		const std::string::size_type username_end{ path.find('/') };
+		const std::string::size_type entity_type_name_end{ username_end == std::string::npos ? std::string::npos : path.find('/', username_end + 1) };
+		if (username_end == 0 || entity_type_name_end == std::string::npos || entity_type_name_end == username_end + 1 || entity_type_name_end + 1 == path.size()) {
+			throw configuration_exception{ "invalid warmup document " + path };
+		}
+
+		warmup_document document;
+		document.username = path.substr(0, username_end);
+		document.entity_type_name = path.substr(username_end + 1, entity_type_name_end - username_end - 1);
+		document.key_path = path.substr(entity_type_name_end + 1);
+		return document;
+	}
+
+	warmup_settings read_warmup_settings(const steeljson::object& config) {
+		warmup_settings settings;
+		if (config.find("warmup") == config.end()) {
+			return settings;
+		}
+
+		try {
+			const steeljson::object& warmup_config{ config.at("warmup").as<const steeljson::object&>() };
+			if (warmup_config.find("connections") != warmup_config.end()) {
+				const std::int64_t connections{ warmup_config.at("connections").as<std::int64_t>() };
+				if (connections < 0) {
+					throw configuration_exception{ "warmup connections must not be negative" };
+				}
+				settings.connections = static_cast<std::size_t>(connections);
+			}
+			if (warmup_config.find("users") != warmup_config.end()) {
+				const steeljson::array& users{ warmup_config.at("users").as<const steeljson::array&>() };
+				for (std::size_t i = 0; i < users.size(); ++i) {
+					settings.users.push_back(users.at(i).as<const std::string&>());
+				}
+			}
+			if (warmup_config.find("documents") != warmup_config.end()) {
+				const steeljson::array& documents{ warmup_config.at("documents").as<const steeljson::array&>() };
+				for (std::size_t i = 0; i < documents.size(); ++i) {
+					settings.documents.push_back(read_warmup_document(documents.at(i).as<const std::string&>()));
+				}
+			}
+		} catch (const configuration_exception&) {
+			throw;
+		} catch (...) {
+			throw configuration_exception{ "invalid warmup configuration" };
+		}
+
+		settings.enabled = true;
+		return settings;
+	}
+
+	struct configuration {
+		steeljson::object config;
+		steeljson::object storage_config;
+		std::unordered_map<std::string, entity_type_descriptor> entity_type_descriptors;
+		warmup_settings warmup;
+	};
+
+	// throws configuration_exception when config.json can not be read or is invalid
+	configuration read_configuration() {
+		configuration result;
+
+		try {
+			std::ifstream ifs{ "config.json" };
+			result.config = steeljson::read_document(ifs).as<const steeljson::object&>();
+			const steeljson::object& storages_config{ result.config.at("storages").as<const steeljson::object&>() };
+			result.storage_config = storages_config.at("main").as<const steeljson::object&>();
+			result.entity_type_descriptors = read_entity_types_descriptors(result.config.at("entity_types").as<const steeljson::object&>());
+			result.warmup = read_warmup_settings(result.config);
+		} catch (const configuration_exception&) {
+			throw;
+		} catch (...) {
+			throw configuration_exception{ "invalid configuration file" };
+		}
+
+		return result;
 	}
 
-	std::unique_ptr<storages::mongodb::storage> storage{ std::make_unique<storages::mongodb::storage>(storage_config, entity_type_descriptors) };
-	document_controller doc_controller{ storage.get(), entity_type_descriptors };
-	crow::SimpleApp application;
+	// opens the pooled connections and fetches the users and documents, so that the first
+	// requests served do not pay for connection setup and cold caches
+	void warm_up(storages::mongodb::storage& storage, const document_controller& doc_controller, const warmup_settings& warmup) {
+		storage.warm_up(warmup.connections, warmup.users);
 
-	CROW_ROUTE(application, "/<string>/<string>/<path>")
-		.methods(crow::HTTPMethod::GET, crow::HTTPMethod::PUT)
-		([&doc_controller](const crow::request& req, const std::string username, const std::string entity_type_name, const std::string key_path) {
+		std::atomic<std::size_t> next_document{ 0 };
+		std::vector<std::future<void>> fetchers;
+		for (std::size_t i = 0; i < std::max<std::size_t>(warmup.connections, 1); ++i) {
+			fetchers.push_back(std::async(std::launch::async, [&doc_controller, &warmup, &next_document]() {
+				for (std::size_t document = next_document++; document < warmup.documents.size(); document = next_document++) {
+					const warmup_document& fetched{ warmup.documents[document] };
+					doc_controller.get_document(fetched.username, fetched.entity_type_name, fetched.key_path);
+				}
+			}));
+		}
+
+		for (std::future<void>& fetcher : fetchers) {
+			fetcher.get();
+		}
+	}
+
+	// swaps in the entity types and storage settings of config.json while requests keep running
+	// on the ones they started with, the storage first so that the collections of new entity
+	// types exist before requests for them are accepted
+	void reload(storages::mongodb::storage& storage, document_controller& doc_controller) {
+		// concurrent reloads must not leave the controller with older entity types than the storage
+		static std::mutex reload_mutex;
+		std::lock_guard<std::mutex> lock{ reload_mutex };
+
+		const configuration next{ read_configuration() };
+		storage.reconfigure(next.storage_config, next.entity_type_descriptors);
+		doc_controller.reconfigure(next.entity_type_descriptors);
+	}
+
+	std::string circuit_state_name(const circuit_state& state) {
+		switch (state) {
+			case circuit_state::closed: {
+				return "closed";
+			}
+			case circuit_state::open: {
+				return "open";
+			}
+			case circuit_state::half_open: {
+				return "half_open";
+			}
+		}
+
+		return "unknown";
+	}
+
+	// response for an exception escaping a handler, logging what went wrong
+	crow::response failure_response(const crow::request& req, const std::exception_ptr& failure) {
+		try {
+			std::rethrow_exception(failure);
+		} catch (const storage_unavailable_exception& e) {
+			crow::response response{ 503, e.message() };
+			const std::chrono::seconds::rep retry_after{ (e.retry_after().count() + 999) / 1000 };
+			response.set_header("Retry-After", std::to_string(retry_after > 0 ? retry_after : 1));
+			return response;
+		} catch (const steelbox::exception& e) {
+			std::cerr << crow::method_name(req.method) << " " << req.url << " failed: " << e.message() << std::endl;
+		} catch (const std::exception& e) {
+			std::cerr << crow::method_name(req.method) << " " << req.url << " failed: " << e.what() << std::endl;
+		} catch (...) {
+			std::cerr << crow::method_name(req.method) << " " << req.url << " failed" << std::endl;
+		}
+
+		return crow::response{ 500 };
+	}
+
+	// sets up the storage and the routes and serves until crow is stopped.
+	// ready is called once the server listens and the warmup, if any, has finished.
+	// A supervised worker leaves reloads to its launcher so that all workers reload.
+	int serve(
+		const configuration& loaded,
+		const std::string& capture_suffix,
+		bool supervised,
+		const std::function<void()>& ready
+	) {
+		// SIGHUP reloads the configuration, blocked before the storage starts its threads
+		block_signal(SIGHUP);
+
+		const steeljson::object& config{ loaded.config };
+		const steeljson::object& storage_config{ loaded.storage_config };
+		const std::unordered_map<std::string, entity_type_descriptor>& entity_type_descriptors{ loaded.entity_type_descriptors };
+		const warmup_settings& warmup{ loaded.warmup };
+		std::atomic<bool> warmed_up{ false };
+
+		std::unique_ptr<storages::mongodb::storage> storage{ std::make_unique<storages::mongodb::storage>(storage_config, entity_type_descriptors) };
+		storages::guarded_storage guarded{ storage.get(), storage_config };
+		document_controller doc_controller{ &guarded, entity_type_descriptors };
+		signal_listener reload_listener{ SIGHUP, [&storage, &doc_controller]() {
 			try {
-				switch (req.method) {
-					case crow::HTTPMethod::GET: {
-						return doc_controller.get_document(username, entity_type_name, key_path);
+				reload(*storage, doc_controller);
+				std::cerr << "configuration reloaded" << std::endl;
+			} catch (const steelbox::exception& e) {
+				std::cerr << "configuration reload failed: " << e.message() << std::endl;
+			} catch (const std::exception& e) {
+				std::cerr << "configuration reload failed: " << e.what() << std::endl;
+			}
+		} };
+		crow::App<traffic_capture> application;
+
+		if (config.find("capture") != config.end()) {
+			try {
+				steeljson::object capture_config{ config.at("capture").as<const steeljson::object&>() };
+				if (!capture_suffix.empty() && capture_config.find("path") != capture_config.end()) {
+					const std::string path{ capture_config.at("path").as<const std::string&>() + capture_suffix };
+					capture_config.erase("path");
+					capture_config.insert(steeljson::object::value_type{ "path", steeljson::value{ path } });
+				}
+				application.get_middleware<traffic_capture>().start(capture_config);
+			} catch (const std::exception&) {
+				std::cerr << "invalid capture configuration" << std::endl;
+				return 1;
+			}
+		}
+
+		CROW_ROUTE(application, "/_stats")
+			.methods(crow::HTTPMethod::GET)
+			([&application, &guarded, &doc_controller]() {
+				const body_buffer_statistics body_statistics{ body_streambuf::statistics() };
+				const std::uint64_t bytes_per_body{ body_statistics.bodies == 0 ? 0 : body_statistics.body_bytes / body_statistics.bodies };
+
+				steeljson::object response_bodies;
+				response_bodies.insert(steeljson::object::value_type{ "bodies", steeljson::value{ static_cast<std::int64_t>(body_statistics.bodies) } });
+				response_bodies.insert(steeljson::object::value_type{ "body_bytes", steeljson::value{ static_cast<std::int64_t>(body_statistics.body_bytes) } });
+				response_bodies.insert(steeljson::object::value_type{ "bytes_per_body", steeljson::value{ static_cast<std::int64_t>(bytes_per_body) } });
+				response_bodies.insert(steeljson::object::value_type{ "allocated_bytes", steeljson::value{ static_cast<std::int64_t>(body_statistics.allocated_bytes) } });
+				response_bodies.insert(steeljson::object::value_type{ "peak_body_bytes", steeljson::value{ static_cast<std::int64_t>(body_statistics.peak_body_bytes) } });
+				const traffic_capture& capture{ application.get_middleware<traffic_capture>() };
+				steeljson::object captured_traffic;
+				captured_traffic.insert(steeljson::object::value_type{ "requests", steeljson::value{ static_cast<std::int64_t>(capture.captured_requests()) } });
+				captured_traffic.insert(steeljson::object::value_type{ "dropped", steeljson::value{ static_cast<std::int64_t>(capture.dropped_requests()) } });
+				steeljson::object storage_operations;
+				for (const std::pair<storages::storage_operation, circuit_breaker_statistics>& operation : guarded.statistics()) {
+					const circuit_breaker_statistics& breaker{ operation.second };
+					steeljson::object operation_statistics;
+					operation_statistics.insert(steeljson::object::value_type{ "state", steeljson::value{ circuit_state_name(breaker.state) } });
+					operation_statistics.insert(steeljson::object::value_type{ "calls", steeljson::value{ static_cast<std::int64_t>(breaker.calls) } });
+					operation_statistics.insert(steeljson::object::value_type{ "failures", steeljson::value{ static_cast<std::int64_t>(breaker.failures) } });
+					operation_statistics.insert(steeljson::object::value_type{ "slow_calls", steeljson::value{ static_cast<std::int64_t>(breaker.slow_calls) } });
+					operation_statistics.insert(steeljson::object::value_type{ "rejected_calls", steeljson::value{ static_cast<std::int64_t>(breaker.rejected_calls) } });
+					operation_statistics.insert(steeljson::object::value_type{ "mean_latency_us", steeljson::value{
+						static_cast<std::int64_t>(breaker.calls == 0 ? 0 : breaker.total_latency_us / breaker.calls)
+					} });
+					storage_operations.insert(steeljson::object::value_type{ storages::storage_operation_name(operation.first), operation_statistics });
+				}
+				steeljson::object statistics;
+				statistics.insert(steeljson::object::value_type{ "response_bodies", response_bodies });
+				statistics.insert(steeljson::object::value_type{ "capture", captured_traffic });
+				statistics.insert(steeljson::object::value_type{ "storage", storage_operations });
+				statistics.insert(steeljson::object::value_type{ "coalesced_reads", steeljson::value{ static_cast<std::int64_t>(doc_controller.coalesced_reads()) } });
+
+				std::ostringstream body_stream;
+				steeljson::write(body_stream, statistics);
+				crow::response response{ 200, body_stream.str() };
+				response.set_header("Content-Type", "application/json");
+
+				return response;
+			});
+
+		CROW_ROUTE(application, "/_ready")
+			.methods(crow::HTTPMethod::GET)
+			([&warmed_up]() {
+				return crow::response{ warmed_up ? 200 : 503 };
+			});
+
+		CROW_ROUTE(application, "/_reload")
+			.methods(crow::HTTPMethod::POST)
+			([&storage, &doc_controller, supervised](const crow::request& req) {
+				if (supervised) {
+					// the launcher forwards the signal to every worker, this one included
+					if (kill(getppid(), SIGHUP) != 0) {
+						return crow::response{ 500 };
 					}
-					case crow::HTTPMethod::PUT: {
-						return doc_controller.put_document(username, entity_type_name, key_path, req.body);
+					return crow::response{ 202 };
+				}
+
+				try {
+					reload(*storage, doc_controller);
+					return crow::response{ 204 };
+				} catch (const configuration_exception& e) {
+					return crow::response{ 400, e.message() };
+				} catch (...) {
+					return failure_response(req, std::current_exception());
+				}
+			});
+
+		// crow picks the route declared first when several match,
+		// so the service routes have to precede the document route
+		CROW_ROUTE(application, "/<string>/_export")
+			.methods(crow::HTTPMethod::GET)
+			([&doc_controller](const crow::request& req, const std::string username) {
+				try {
+					const char* cursor{ req.url_params.get("cursor") };
+					const char* limit{ req.url_params.get("limit") };
+					return doc_controller.export_documents(username, "", cursor ? cursor : "", limit ? limit : "");
+				} catch (...) {
+					return failure_response(req, std::current_exception());
+				}
+			});
+
+		CROW_ROUTE(application, "/<string>/_export/<string>")
+			.methods(crow::HTTPMethod::GET)
+			([&doc_controller](const crow::request& req, const std::string username, const std::string entity_type_name) {
+				try {
+					const char* cursor{ req.url_params.get("cursor") };
+					const char* limit{ req.url_params.get("limit") };
+					return doc_controller.export_documents(username, entity_type_name, cursor ? cursor : "", limit ? limit : "");
+				} catch (...) {
+					return failure_response(req, std::current_exception());
+				}
+			});
+
+		CROW_ROUTE(application, "/<string>/_import")
+			.methods(crow::HTTPMethod::POST)
+			([&doc_controller](const crow::request& req, const std::string username) {
+				try {
+					return doc_controller.import_documents(username, req.body);
+				} catch (...) {
+					return failure_response(req, std::current_exception());
+				}
+			});
+
+		CROW_ROUTE(application, "/<string>/_query/<string>")
+			.methods(crow::HTTPMethod::POST)
+			([&doc_controller](const crow::request& req, const std::string username, const std::string entity_type_name) {
+				try {
+					const char* limit{ req.url_params.get("limit") };
+					return doc_controller.query_documents(username, entity_type_name, req.body, limit ? limit : "");
+				} catch (...) {
+					return failure_response(req, std::current_exception());
+				}
+			});
+
+		CROW_ROUTE(application, "/<string>/<string>")
+			.methods(crow::HTTPMethod::GET, crow::HTTPMethod::POST)
+			([&doc_controller](const crow::request& req, const std::string username, const std::string entity_type_name) {
+				try {
+					switch (req.method) {
+						case crow::HTTPMethod::GET: {
+							const char* cursor{ req.url_params.get("cursor") };
+							const char* limit{ req.url_params.get("limit") };
+							return doc_controller.get_documents(username, entity_type_name, "", cursor ? cursor : "", limit ? limit : "");
+						}
+						case crow::HTTPMethod::POST: {
+							return doc_controller.get_documents_by_key_paths(username, entity_type_name, req.body);
+						}
+						default: {
+							throw std::exception();
+						}
 					}
-					default: {
-						throw std::exception();
+				} catch (...) {
+					return failure_response(req, std::current_exception());
+				}
+			});
+
+		CROW_ROUTE(application, "/<string>/<string>/<path>")
+			.methods(crow::HTTPMethod::GET, crow::HTTPMethod::PUT)
+			([&doc_controller](const crow::request& req, const std::string username, const std::string entity_type_name, const std::string key_path) {
+				try {
+					switch (req.method) {
+						case crow::HTTPMethod::GET: {
+							if (doc_controller.is_key_path_prefix(entity_type_name, key_path)) {
+								const char* cursor{ req.url_params.get("cursor") };
+								const char* limit{ req.url_params.get("limit") };
+								return doc_controller.get_documents(username, entity_type_name, key_path, cursor ? cursor : "", limit ? limit : "");
+							}
+							return doc_controller.get_document(username, entity_type_name, key_path);
+						}
+						case crow::HTTPMethod::PUT: {
+							return doc_controller.put_document(username, entity_type_name, key_path, req.body);
+						}
+						default: {
+							throw std::exception();
+						}
 					}
+				} catch (...) {
+					return failure_response(req, std::current_exception());
+				}
+			});
+
+		// a launcher stops the worker this one replaces once it is ready, so ready waits until
+		// the server accepts connections, and the warmup runs while /_ready tells it is not done
+		std::promise<bool> listening;
+		std::future<bool> listened{ listening.get_future() };
+		std::once_flag listening_reported;
+		const auto report_listening = [&listening, &listening_reported](bool listens) {
+			std::call_once(listening_reported, [&listening, listens]() { listening.set_value(listens); });
+		};
+		notify_on_listen(server_port, [&report_listening]() { report_listening(true); });
+
+		std::future<void> starting{ std::async(std::launch::async, [&storage, &doc_controller, &warmup, &warmed_up, &ready, &listened]() {
+			if (!listened.get()) {
+				return;
+			}
+
+			if (warmup.enabled) {
+				try {
+					warm_up(*storage, doc_controller, warmup);
+				} catch (const steelbox::exception& e) {
+					std::cerr << "warmup failed: " << e.message() << std::endl;
+				} catch (const std::exception& e) {
+					std::cerr << "warmup failed: " << e.what() << std::endl;
+				} catch (...) {
+					std::cerr << "warmup failed" << std::endl;
 				}
-			} catch (...) {
-				return crow::response{ 500 };
 			}
-		});
+			warmed_up = true;
+			ready();
+		}) };
 
-	application.port(31700).run();
+		try {
+			application.port(server_port).run();
+		} catch (...) {
+			notify_on_listen(0, { });
+			report_listening(false);
+			throw;
+		}
+		notify_on_listen(0, { });
+		report_listening(false);
 
-	return 0;
+		return 0;
+	}
+
+}
+
+int main(int, char**) {
+	configuration current_configuration;
+	std::int64_t workers{ 0 };
+
+	try {
+		current_configuration = read_configuration();
+		const steeljson::object& config{ current_configuration.config };
+		if (config.find("workers") != config.end()) {
+			workers = config.at("workers").as<std::int64_t>();
+		}
+	} catch (const configuration_exception& e) {
+		std::cerr << e.message() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "invalid configuration file" << std::endl;
+		return 1;
+	}
+
+	if (workers < 0) {
+		std::cerr << "invalid number of workers" << std::endl;
+		return 1;
+	}
+
+	if (workers == 0) {
+		return serve(current_configuration, "", false, []() {});
+	}
+
+	// every worker has its own storage, connection pool and caches and listens on
+	// the same port, the kernel balancing the connections between them
+	try {
+		enable_reuse_port(server_port);
+		worker_launcher launcher{
+			static_cast<std::size_t>(workers),
+			[&current_configuration](std::size_t slot, const std::function<void()>& ready) {
+				return serve(current_configuration, "." + std::to_string(slot), true, ready);
+			},
+			// a worker restarted after a reload must not come back with the entity types it started with
+			[&current_configuration]() {
+				try {
+					current_configuration = read_configuration();
+				} catch (const configuration_exception& e) {
+					std::cerr << "configuration reload failed, workers keep starting with the previous one: " << e.message() << std::endl;
+				}
+			}
+		};
+		return launcher.run();
+	} catch (const std::exception& e) {
+		std::cerr << "workers failed: " << e.what() << std::endl;
+		return 1;
+	}
 }
+
@@ -0,0 +1,45 @@
+#include "periodic_task.h"
+#include <stdexcept>
+
+using namespace steelbox;
+
+periodic_task::periodic_task(const std::chrono::milliseconds& interval, const std::function<void()>& task, bool run_at_start) :
+	interval(interval),
+	task(task),
+	run_at_start(run_at_start),
+	stopping(false) {
+	if (interval.count() <= 0) {
+		throw std::invalid_argument{ "interval must be positive" };
+	}
+
+	this->thread = std::thread{ &periodic_task::run, this };
+}
+
+periodic_task::~periodic_task() {
+	{
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		this->stopping = true;
+	}
+	this->stop_requested.notify_all();
+	this->thread.join();
+}
+
+void periodic_task::run() {
+	if (this->run_at_start) {
+		try {
+			this->task();
+		} catch (...) {
+		}
+	}
+
+	std::unique_lock<std::mutex> lock{ this->mutex };
+
+	while (!this->stop_requested.wait_for(lock, this->interval, [this]() { return this->stopping; })) {
+		lock.unlock();
+		try {
+			this->task();
+		} catch (...) {
+		}
+		lock.lock();
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef STEELBOX_PERIODIC_TASK_H
+#define STEELBOX_PERIODIC_TASK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace steelbox {
+
+	// Runs a task on its own thread every interval until destroyed, and right away when run_at_start is set.
+	// Exceptions thrown by the task are swallowed so the next run still happens.
+	class periodic_task {
+		public:
+			periodic_task(const std::chrono::milliseconds& interval, const std::function<void()>& task, bool run_at_start = false);
+			periodic_task(const periodic_task&) = delete;
+
+			~periodic_task();
+
+			periodic_task& operator=(const periodic_task&) = delete;
+
+		private:
+			void run();
+
+		private:
+			std::chrono::milliseconds interval;
+			std::function<void()> task;
+			bool run_at_start;
+			std::mutex mutex;
+			std::condition_variable stop_requested;
+			bool stopping;
+			std::thread thread;
+	};
+
+}
+
+#endif // STEELBOX_PERIODIC_TASK_H
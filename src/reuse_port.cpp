@@ -0,0 +1,58 @@
+#include "reuse_port.h"
+#include <atomic>
+#include <stdexcept>
+#ifdef __linux__
+#include <cerrno>
+#include <dlfcn.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+using namespace steelbox;
+
+namespace {
+
+	std::atomic<std::uint16_t> reuse_port{ 0 };
+
+}
+
+void steelbox::enable_reuse_port(std::uint16_t port) {
+#ifdef __linux__
+	reuse_port.store(port);
+#else
+	(void)port;
+	throw std::runtime_error{ "SO_REUSEPORT is only supported on Linux" };
+#endif
+}
+
+#ifdef __linux__
+
+// takes precedence over the bind of the C library, which is called through dlsym
+extern "C" int bind(int socket, const struct sockaddr* address, socklen_t address_length) {
+	using bind_function = int (*)(int, const struct sockaddr*, socklen_t);
+	static const bind_function system_bind{ reinterpret_cast<bind_function>(dlsym(RTLD_NEXT, "bind")) };
+	if (system_bind == nullptr) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	const std::uint16_t port{ reuse_port.load() };
+	if (port != 0 && address != nullptr) {
+		std::uint16_t bound_port{ 0 };
+		if (address->sa_family == AF_INET && address_length >= sizeof(sockaddr_in)) {
+			bound_port = ntohs(reinterpret_cast<const sockaddr_in*>(address)->sin_port);
+		} else if (address->sa_family == AF_INET6 && address_length >= sizeof(sockaddr_in6)) {
+			bound_port = ntohs(reinterpret_cast<const sockaddr_in6*>(address)->sin6_port);
+		}
+		if (bound_port == port) {
+			const int enabled{ 1 };
+			if (::setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, &enabled, sizeof(enabled)) != 0) {
+				return -1;
+			}
+		}
+	}
+
+	return system_bind(socket, address, address_length);
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef STEELBOX_REUSE_PORT_H
+#define STEELBOX_REUSE_PORT_H
+
+#include <cstdint>
+
+namespace steelbox {
+
+	// Makes sockets bound to port from now on set SO_REUSEPORT before binding,
+	// so that several processes can listen on it and the kernel spreads the
+	// connections between them. crow creates and binds its acceptor itself,
+	// this is done by wrapping bind(2) and is only available on Linux.
+	void enable_reuse_port(std::uint16_t port);
+
+}
+
+#endif // STEELBOX_REUSE_PORT_H
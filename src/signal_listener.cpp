@@ -0,0 +1,73 @@
+#include "signal_listener.h"
+#include <ctime>
+#include <system_error>
+#include <pthread.h>
+#include <signal.h>
+
+using namespace steelbox;
+
+#ifdef __linux__
+namespace {
+
+	// how long the listener waits for the signal before checking whether it should stop
+	const long stop_check_interval_ns = 200 * 1000 * 1000;
+
+}
+#endif
+
+void steelbox::block_signal(int signal) {
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, signal);
+	const int result{ pthread_sigmask(SIG_BLOCK, &signals, nullptr) };
+	if (result != 0) {
+		throw std::system_error{ result, std::system_category(), "pthread_sigmask failed" };
+	}
+}
+
+signal_listener::signal_listener(int signal, const std::function<void()>& handler) :
+	signal(signal),
+	handler(handler),
+	stopping(false) {
+	// sigtimedwait only takes signals that are blocked in the listening thread
+	block_signal(signal);
+
+	this->thread = std::thread{ &signal_listener::run, this };
+}
+
+signal_listener::~signal_listener() {
+	this->stopping = true;
+#ifndef __linux__
+	// wakes up sigwait, which cannot time out
+	pthread_kill(this->thread.native_handle(), this->signal);
+#endif
+	this->thread.join();
+}
+
+void signal_listener::run() {
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, this->signal);
+#ifdef __linux__
+	const timespec timeout{ 0, stop_check_interval_ns };
+#endif
+
+	while (!this->stopping) {
+#ifdef __linux__
+		if (sigtimedwait(&signals, nullptr, &timeout) != this->signal) {
+			continue;
+		}
+#else
+		// sigtimedwait is missing on some systems, the destructor sends the signal instead
+		int received;
+		if (sigwait(&signals, &received) != 0 || this->stopping) {
+			continue;
+		}
+#endif
+
+		try {
+			this->handler();
+		} catch (...) {
+		}
+	}
+}
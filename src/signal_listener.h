@@ -0,0 +1,39 @@
+#ifndef STEELBOX_SIGNAL_LISTENER_H
+#define STEELBOX_SIGNAL_LISTENER_H
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+namespace steelbox {
+
+	// Blocks the signal in the calling thread and the threads it starts afterwards,
+	// threads started before keep receiving it and its default action.
+	void block_signal(int signal);
+
+	// Calls a handler on its own thread whenever the signal arrives until destroyed.
+	// The signal has to be blocked with block_signal before the process starts any
+	// thread, or it may be delivered to that thread instead of the listener.
+	// Exceptions thrown by the handler are swallowed.
+	class signal_listener {
+		public:
+			signal_listener(int signal, const std::function<void()>& handler);
+			signal_listener(const signal_listener&) = delete;
+
+			~signal_listener();
+
+			signal_listener& operator=(const signal_listener&) = delete;
+
+		private:
+			void run();
+
+		private:
+			int signal;
+			std::function<void()> handler;
+			std::atomic<bool> stopping;
+			std::thread thread;
+	};
+
+}
+
+#endif // STEELBOX_SIGNAL_LISTENER_H
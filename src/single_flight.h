@@ -0,0 +1,101 @@
+#ifndef STEELBOX_SINGLE_FLIGHT_H
+#define STEELBOX_SINGLE_FLIGHT_H
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace steelbox {
+
+	// Coalesces concurrent calls for the same key: while a call is running,
+	// callers asking for its key wait for it and share its result or exception.
+	template <typename T>
+	class single_flight {
+		public:
+			single_flight() :
+				next_flight_id(0),
+				shared(0) {
+			}
+			single_flight(const single_flight&) = delete;
+
+			~single_flight() = default;
+
+			single_flight& operator=(const single_flight&) = delete;
+
+			T run(const std::string& key, const std::function<T()>& call) {
+				std::promise<T> promise;
+				std::shared_future<T> running_result;
+				std::uint64_t flight_id{ 0 };
+				{
+					std::lock_guard<std::mutex> lock{ this->mutex };
+					const typename std::unordered_map<std::string, flight>::const_iterator flight_it{ this->flights.find(key) };
+					if (flight_it != this->flights.cend()) {
+						running_result = flight_it->second.result;
+					} else {
+						flight_id = this->next_flight_id++;
+						this->flights.insert(std::make_pair(key, flight{ flight_id, promise.get_future().share() }));
+					}
+				}
+
+				if (running_result.valid()) {
+					++this->shared;
+					return running_result.get();
+				}
+
+				// the flight is removed before its result is published so that
+				// callers arriving afterwards never see a result older than their request
+				try {
+					T value{ call() };
+					this->land(key, flight_id);
+					promise.set_value(value);
+					return value;
+				} catch (...) {
+					this->land(key, flight_id);
+					promise.set_exception(std::current_exception());
+					throw;
+				}
+			}
+
+			// later callers start a new call instead of joining the running one,
+			// used when the result of the running call may already be outdated
+			void forget(const std::string& key) {
+				std::lock_guard<std::mutex> lock{ this->mutex };
+				this->flights.erase(key);
+			}
+
+			// calls answered with the result of another caller's call
+			std::uint64_t shared_calls() const {
+				return this->shared.load();
+			}
+
+		private:
+			struct flight {
+				std::uint64_t id;
+				std::shared_future<T> result;
+			};
+
+			void land(const std::string& key, std::uint64_t flight_id) {
+				std::lock_guard<std::mutex> lock{ this->mutex };
+				const typename std::unordered_map<std::string, flight>::const_iterator flight_it{ this->flights.find(key) };
+				// a forgotten flight may have been replaced by a newer one
+				if (flight_it != this->flights.cend() && flight_it->second.id == flight_id) {
+					this->flights.erase(flight_it);
+				}
+			}
+
+		private:
+			std::mutex mutex;
+			std::unordered_map<std::string, flight> flights;
+			std::uint64_t next_flight_id;
+			std::atomic<std::uint64_t> shared;
+	};
+
+}
+
+#endif // STEELBOX_SINGLE_FLIGHT_H
@@ -0,0 +1,196 @@
+#include "guarded_storage.h"
+#include <cstdint>
+#include <stdexcept>
+#include <system_error>
+#include "../exception.h"
+
+using namespace steelbox::storages;
+
+namespace {
+
+	steelbox::circuit_breaker_settings read_circuit_breaker_settings(const steeljson::object& storage_config) {
+		steelbox::circuit_breaker_settings settings;
+		if (storage_config.find("circuit_breaker") == storage_config.end()) {
+			return settings;
+		}
+
+		std::int64_t minimum_calls{ static_cast<std::int64_t>(settings.minimum_calls) };
+		std::int64_t half_open_calls{ static_cast<std::int64_t>(settings.half_open_calls) };
+		try {
+			const steeljson::object& breaker_descriptor{ storage_config.at("circuit_breaker").as<const steeljson::object&>() };
+			if (breaker_descriptor.find("failure_rate") != breaker_descriptor.end()) {
+				settings.failure_rate = breaker_descriptor.at("failure_rate").as<double>();
+			}
+			if (breaker_descriptor.find("minimum_calls") != breaker_descriptor.end()) {
+				minimum_calls = breaker_descriptor.at("minimum_calls").as<std::int64_t>();
+			}
+			if (breaker_descriptor.find("window") != breaker_descriptor.end()) {
+				settings.window = std::chrono::seconds{ breaker_descriptor.at("window").as<std::int64_t>() };
+			}
+			if (breaker_descriptor.find("open_duration") != breaker_descriptor.end()) {
+				settings.open_duration = std::chrono::milliseconds{ breaker_descriptor.at("open_duration").as<std::int64_t>() };
+			}
+			if (breaker_descriptor.find("half_open_calls") != breaker_descriptor.end()) {
+				half_open_calls = breaker_descriptor.at("half_open_calls").as<std::int64_t>();
+			}
+		} catch (...) {
+			throw steelbox::configuration_exception{ "invalid circuit breaker configuration" };
+		}
+
+		if (settings.failure_rate <= 0.0 || settings.failure_rate > 1.0) {
+			throw steelbox::configuration_exception{ "circuit breaker failure rate must be in (0, 1]" };
+		}
+		if (minimum_calls < 0 || half_open_calls <= 0 || settings.window.count() <= 0 || settings.open_duration.count() <= 0) {
+			throw steelbox::configuration_exception{ "invalid circuit breaker configuration" };
+		}
+		settings.minimum_calls = static_cast<std::size_t>(minimum_calls);
+		settings.half_open_calls = static_cast<std::size_t>(half_open_calls);
+
+		return settings;
+	}
+
+}
+
+guarded_storage::guarded_storage(storage* guarded, const steeljson::object& storage_config) :
+	guarded(guarded) {
+	if (guarded == nullptr) {
+		throw std::invalid_argument{ "guarded storage must not be null" };
+	}
+
+	const circuit_breaker_settings settings{ read_circuit_breaker_settings(storage_config) };
+	const operation_deadlines deadlines{ read_operation_deadlines(storage_config) };
+	for (const storage_operation& operation : storage_operations()) {
+		circuit_breaker_settings operation_settings{ settings };
+		if (deadlines.count(operation) != 0) {
+			operation_settings.slow_call_duration = deadlines.at(operation);
+		}
+		this->breakers[operation].reset(new circuit_breaker{ operation_settings });
+	}
+}
+
+std::vector<steeljson::value> guarded_storage::get(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::unordered_map<std::string, const boost::any>& entity_filter
+) {
+	std::vector<steeljson::value> result;
+	this->guard(storage_operation::get, [&]() {
+		result = this->guarded->get(username, entity_type_name, entity_filter);
+	});
+
+	return result;
+}
+
+std::vector<boost::optional<steeljson::value>> guarded_storage::get_many(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::vector<std::unordered_map<std::string, const boost::any>>& entity_keys
+) {
+	std::vector<boost::optional<steeljson::value>> result;
+	this->guard(storage_operation::get_many, [&]() {
+		result = this->guarded->get_many(username, entity_type_name, entity_keys);
+	});
+
+	return result;
+}
+
+void guarded_storage::put(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::unordered_map<std::string, const boost::any>& entity_key,
+	const steeljson::value& data
+) {
+	this->guard(storage_operation::put, [&]() {
+		this->guarded->put(username, entity_type_name, entity_key, data);
+	});
+}
+
+std::vector<entity> guarded_storage::list(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::unordered_map<std::string, const boost::any>& key_prefix,
+	const std::vector<boost::any>& after,
+	std::size_t limit
+) {
+	std::vector<entity> result;
+	this->guard(storage_operation::list, [&]() {
+		result = this->guarded->list(username, entity_type_name, key_prefix, after, limit);
+	});
+
+	return result;
+}
+
+std::vector<entity> guarded_storage::query(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::vector<data_predicate>& predicates,
+	std::size_t limit
+) {
+	std::vector<entity> result;
+	this->guard(storage_operation::query, [&]() {
+		result = this->guarded->query(username, entity_type_name, predicates, limit);
+	});
+
+	return result;
+}
+
+void guarded_storage::put_many(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::vector<std::pair<std::unordered_map<std::string, const boost::any>, steeljson::value>>& entities
+) {
+	this->guard(storage_operation::put_many, [&]() {
+		this->guarded->put_many(username, entity_type_name, entities);
+	});
+}
+
+void guarded_storage::export_entities(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::string& after_entity_type_name,
+	const std::vector<boost::any>& after,
+	std::size_t limit,
+	const entity_consumer& consumer
+) {
+	this->guard(storage_operation::export_entities, [&]() {
+		this->guarded->export_entities(username, entity_type_name, after_entity_type_name, after, limit, consumer);
+	});
+}
+
+std::vector<std::pair<storage_operation, steelbox::circuit_breaker_statistics>> guarded_storage::statistics() const {
+	std::vector<std::pair<storage_operation, circuit_breaker_statistics>> statistics;
+	for (const std::map<storage_operation, std::unique_ptr<circuit_breaker>>::value_type& breaker : this->breakers) {
+		statistics.push_back(std::make_pair(breaker.first, breaker.second->statistics()));
+	}
+
+	return statistics;
+}
+
+void guarded_storage::guard(const storage_operation& operation, const std::function<void()>& call) {
+	circuit_breaker& breaker{ *this->breakers.at(operation) };
+	const circuit_breaker::permit call_permit{ breaker.acquire() };
+	if (!call_permit.granted) {
+		throw storage_unavailable_exception{ storage_operation_name(operation) + " is unavailable", call_permit.retry_after };
+	}
+
+	const std::chrono::steady_clock::time_point start{ std::chrono::steady_clock::now() };
+	const auto elapsed = [&start]() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+	};
+
+	try {
+		call();
+	} catch (const storage_exception&) {
+		breaker.release(call_permit, true, elapsed());
+		throw;
+	} catch (const std::system_error&) {
+		// errors of the driver
+		breaker.release(call_permit, true, elapsed());
+		throw;
+	} catch (...) {
+		// anything else, like an unknown user, is an answer of a working storage
+		breaker.release(call_permit, false, elapsed());
+		throw;
+	}
+	breaker.release(call_permit, false, elapsed());
+}
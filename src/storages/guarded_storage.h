@@ -0,0 +1,90 @@
+#ifndef STEELBOX_GUARDED_STORAGE_H
+#define STEELBOX_GUARDED_STORAGE_H
+
+#include "../circuit_breaker.h"
+#include "storage.h"
+#include "storage_operation.h"
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <steeljson/value.h>
+
+namespace steelbox {
+namespace storages {
+
+	// Storage wrapping another one with a circuit breaker per operation.
+	// Failing operations open their breaker, after which calls throw
+	// storage_unavailable_exception without reaching the wrapped storage.
+	class guarded_storage : public storage {
+		public:
+			// reads the optional "circuit_breaker" and "deadlines" objects of
+			// the storage configuration, calls slower than their deadline count as failures
+			guarded_storage(storage* guarded, const steeljson::object& storage_config);
+			guarded_storage(const guarded_storage&) = delete;
+
+			~guarded_storage() = default;
+
+			guarded_storage& operator=(const guarded_storage&) = delete;
+
+			virtual std::vector<steeljson::value> get(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::unordered_map<std::string, const boost::any>& entity_filter
+			);
+			virtual std::vector<boost::optional<steeljson::value>> get_many(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::vector<std::unordered_map<std::string, const boost::any>>& entity_keys
+			);
+			virtual void put(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::unordered_map<std::string, const boost::any>& entity_key,
+				const steeljson::value& data
+			);
+			virtual std::vector<entity> list(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::unordered_map<std::string, const boost::any>& key_prefix,
+				const std::vector<boost::any>& after,
+				std::size_t limit
+			);
+			virtual std::vector<entity> query(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::vector<data_predicate>& predicates,
+				std::size_t limit
+			);
+			virtual void put_many(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::vector<std::pair<std::unordered_map<std::string, const boost::any>, steeljson::value>>& entities
+			);
+			virtual void export_entities(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::string& after_entity_type_name,
+				const std::vector<boost::any>& after,
+				std::size_t limit,
+				const entity_consumer& consumer
+			);
+
+			std::vector<std::pair<storage_operation, circuit_breaker_statistics>> statistics() const;
+
+		private:
+			// runs call under the breaker of the operation, throwing storage_unavailable_exception while it is open
+			void guard(const storage_operation& operation, const std::function<void()>& call);
+
+		private:
+			storage* guarded;
+			std::map<storage_operation, std::unique_ptr<circuit_breaker>> breakers;
+	};
+
+}
+}
+
+#endif // STEELBOX_GUARDED_STORAGE_H
@@ -0,0 +1,219 @@
+#include "change_stream_watcher.h"
+#include <exception>
+#include <stdexcept>
+#include <utility>
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <mongocxx/exception/exception.hpp>
+#include <mongocxx/exception/operation_exception.hpp>
+#include <mongocxx/options/change_stream.hpp>
+#include <mongocxx/pipeline.hpp>
+
+using namespace steelbox::storages::mongodb;
+
+using document_builder = bsoncxx::builder::basic::document;
+using array_builder = bsoncxx::builder::basic::array;
+using bsoncxx::builder::basic::kvp;
+
+namespace {
+
+	// how long the server holds an empty batch, bounding how long stopping takes
+	const std::chrono::milliseconds max_await_time{ 1000 };
+
+	// errors of a resume whose token the server can no longer resume after,
+	// 40576 was sent by MongoDB 3.6 before the named codes existed
+	const int change_stream_fatal_error_code = 280;
+	const int change_stream_history_lost_code = 286;
+	const int change_stream_resume_point_lost_code = 40576;
+
+	bool is_history_lost(const mongocxx::operation_exception& e) {
+		const int code{ e.code().value() };
+		return code == change_stream_fatal_error_code
+			|| code == change_stream_history_lost_code
+			|| code == change_stream_resume_point_lost_code;
+	}
+
+}
+
+change_stream_watcher::change_stream_watcher(
+	const std::shared_ptr<mongocxx::pool>& pool,
+	const std::string& db_name,
+	const std::vector<std::string>& collection_names,
+	const std::chrono::milliseconds& retry_interval,
+	const change_handler& on_change,
+	const reset_handler& on_reset
+) :
+	pool(pool),
+	db_name(db_name),
+	retry_interval(retry_interval),
+	on_change(on_change),
+	on_reset(on_reset),
+	collection_names(collection_names),
+	collections_changed(false),
+	stopping(false) {
+	if (retry_interval.count() <= 0) {
+		throw std::invalid_argument{ "retry interval must be positive" };
+	}
+
+	this->open(collection_names);
+	this->thread = std::thread{ &change_stream_watcher::run, this };
+}
+
+change_stream_watcher::~change_stream_watcher() {
+	{
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		this->stopping = true;
+	}
+	this->stop_requested.notify_all();
+	this->thread.join();
+}
+
+void change_stream_watcher::watch(const std::vector<std::string>& collection_names) {
+	std::lock_guard<std::mutex> lock{ this->mutex };
+	this->collection_names = collection_names;
+	this->collections_changed = true;
+}
+
+void change_stream_watcher::run() {
+	bool reset_pending{ false };
+
+	while (true) {
+		std::vector<std::string> reopened_collection_names;
+		{
+			std::lock_guard<std::mutex> lock{ this->mutex };
+			if (this->stopping) {
+				return;
+			}
+			if (this->collections_changed) {
+				this->collections_changed = false;
+				this->stream.reset();
+				// without a change handled yet there is nothing to resume after
+				if (!this->resume_token) {
+					reset_pending = true;
+				}
+			}
+			if (!this->stream) {
+				reopened_collection_names = this->collection_names;
+			}
+		}
+
+		try {
+			if (!this->stream) {
+				this->open(reopened_collection_names);
+			}
+			// the stream is open again, so changes from now on are not missed by the reset
+			if (reset_pending) {
+				this->on_reset();
+				reset_pending = false;
+			}
+
+			bool batch_handled{ true };
+			for (const bsoncxx::document::view& change : *this->stream) {
+				if (change["operationType"].get_utf8().value.to_string() == "invalidate") {
+					this->stream.reset();
+					this->resume_token = bsoncxx::stdx::nullopt;
+					reset_pending = true;
+					break;
+				}
+
+				// a change the handler fails on is skipped, one the connection fails on
+				// is handled again once the stream resumes before it
+				try {
+					this->on_change(change);
+				} catch (const mongocxx::exception&) {
+					throw;
+				} catch (...) {
+				}
+				this->resume_token = bsoncxx::document::value{ change["_id"].get_document().value };
+
+				std::lock_guard<std::mutex> lock{ this->mutex };
+				if (this->stopping || this->collections_changed) {
+					batch_handled = false;
+					break;
+				}
+			}
+
+			// the token after the batch moves on even when no watched collection changed,
+			// so a resume on a quiet database does not start from a change long gone
+			if (this->stream && batch_handled) {
+				const bsoncxx::stdx::optional<bsoncxx::document::view> batch_resume_token{ this->stream->get_resume_token() };
+				if (batch_resume_token) {
+					this->resume_token = bsoncxx::document::value{ *batch_resume_token };
+				}
+			}
+		} catch (const mongocxx::operation_exception& e) {
+			this->stream.reset();
+			if (is_history_lost(e)) {
+				this->resume_token = bsoncxx::stdx::nullopt;
+				reset_pending = true;
+			}
+			if (!this->wait_for_retry()) {
+				return;
+			}
+		} catch (const mongocxx::exception&) {
+			this->stream.reset();
+			if (!this->wait_for_retry()) {
+				return;
+			}
+		} catch (...) {
+			// a failed reset is still pending and tried again after the retry interval
+			this->stream.reset();
+			if (!this->wait_for_retry()) {
+				return;
+			}
+		}
+	}
+}
+
+void change_stream_watcher::open(const std::vector<std::string>& collection_names) {
+	this->stream.reset();
+
+	array_builder watched_collections;
+	for (const std::string& collection_name : collection_names) {
+		watched_collections.append(collection_name);
+	}
+	array_builder watched_operations;
+	watched_operations.append("insert");
+	watched_operations.append("replace");
+
+	document_builder collection_condition;
+	collection_condition.append(kvp("$in", watched_collections.extract()));
+	document_builder operation_condition;
+	operation_condition.append(kvp("$in", watched_operations.extract()));
+	document_builder watched_change;
+	watched_change.append(kvp("ns.coll", collection_condition.extract()));
+	watched_change.append(kvp("operationType", operation_condition.extract()));
+	document_builder invalidation;
+	invalidation.append(kvp("operationType", "invalidate"));
+	array_builder alternatives;
+	alternatives.append(watched_change.extract());
+	alternatives.append(invalidation.extract());
+	document_builder match;
+	match.append(kvp("$or", alternatives.extract()));
+	// the data can be large and is not needed to know which entities exist
+	document_builder projection;
+	projection.append(kvp("fullDocument.data", 0));
+
+	mongocxx::pipeline pipeline;
+	pipeline.match(match.extract());
+	pipeline.project(projection.extract());
+
+	mongocxx::options::change_stream opts;
+	opts.max_await_time(max_await_time);
+	if (this->resume_token) {
+		opts.resume_after(this->resume_token->view());
+	}
+
+	mongocxx::pool::entry next_client{ this->pool->acquire() };
+	mongocxx::database database{ (*next_client)[this->db_name] };
+	std::unique_ptr<mongocxx::change_stream> next_stream{ new mongocxx::change_stream{ database.watch(pipeline, opts) } };
+
+	this->client = std::move(next_client);
+	this->stream = std::move(next_stream);
+}
+
+bool change_stream_watcher::wait_for_retry() {
+	std::unique_lock<std::mutex> lock{ this->mutex };
+
+	return !this->stop_requested.wait_for(lock, this->retry_interval, [this]() { return this->stopping; });
+}
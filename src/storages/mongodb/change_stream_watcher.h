@@ -0,0 +1,84 @@
+#ifndef STEELBOX_MONGODB_CHANGE_STREAM_WATCHER_H
+#define STEELBOX_MONGODB_CHANGE_STREAM_WATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <bsoncxx/document/value.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <bsoncxx/stdx/optional.hpp>
+#include <mongocxx/change_stream.hpp>
+#include <mongocxx/pool.hpp>
+
+namespace steelbox {
+namespace storages {
+namespace mongodb {
+
+	// Follows the inserts and replacements in some collections of a database on its own
+	// thread until destroyed. After a disconnect the stream is opened again after the last
+	// change handled, so no change is missed. When that is not possible, because the server
+	// no longer has the changes or the stream was invalidated, the stream starts over and
+	// the reset handler is called as changes may have been missed.
+	// The resume token is only kept in memory, a new watcher starts with the changes made
+	// after it was constructed, so its owner rebuilds whatever it derives from them.
+	// Change streams need a replica set, a single node one is enough.
+	class change_stream_watcher {
+		public:
+			// receives the change events as sent by MongoDB, fullDocument without its data
+			using change_handler = std::function<void(const bsoncxx::document::view&)>;
+			using reset_handler = std::function<void()>;
+
+			// the stream is opened before the constructor returns so that every change made
+			// afterwards is seen, throws mongocxx::exception when it can not be opened
+			change_stream_watcher(
+				const std::shared_ptr<mongocxx::pool>& pool,
+				const std::string& db_name,
+				const std::vector<std::string>& collection_names,
+				const std::chrono::milliseconds& retry_interval,
+				const change_handler& on_change,
+				const reset_handler& on_reset
+			);
+			change_stream_watcher(const change_stream_watcher&) = delete;
+
+			~change_stream_watcher();
+
+			change_stream_watcher& operator=(const change_stream_watcher&) = delete;
+
+			// reopens the stream for other collections, resuming after the last change handled
+			void watch(const std::vector<std::string>& collection_names);
+
+		private:
+			void run();
+			void open(const std::vector<std::string>& collection_names);
+			// false when the watcher is stopping
+			bool wait_for_retry();
+
+		private:
+			std::shared_ptr<mongocxx::pool> pool;
+			std::string db_name;
+			std::chrono::milliseconds retry_interval;
+			change_handler on_change;
+			reset_handler on_reset;
+			std::mutex mutex;
+			std::condition_variable stop_requested;
+			std::vector<std::string> collection_names;
+			bool collections_changed;
+			bool stopping;
+			// only used by the watching thread once it runs
+			bsoncxx::stdx::optional<bsoncxx::document::value> resume_token;
+			mongocxx::pool::entry client;
+			// declared after client, the stream uses its connection
+			std::unique_ptr<mongocxx::change_stream> stream;
+			std::thread thread;
+	};
+
+}
+}
+}
+
+#endif // STEELBOX_MONGODB_CHANGE_STREAM_WATCHER_H
@@ -145,9 +145,7 @@ steeljson::value mongodb::build_json(const bsoncxx::types::value& value) {
 			bsoncxx::document::view document_view{ bson_document };
 
 			for (bsoncxx::document::element element : document_view) {
-				const std::string key{ element.key().to_string() };
-				const steeljson::object::value_type object_member{ key, build_json(element.get_value()) };
-				object.insert(object_member);
+				object.insert(steeljson::object::value_type{ element.key().to_string(), build_json(element.get_value()) });
 			}
 			return object;
 		}
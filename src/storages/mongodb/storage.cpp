@@ -1,9 +1,27 @@
 #include "storage.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <thread>
 #include <utility>
 #include <bsoncxx/stdx/optional.hpp>
+#include <bsoncxx/types.hpp>
+#include <bsoncxx/validate.hpp>
+#include <mongocxx/bulk_write.hpp>
 #include <mongocxx/exception/operation_exception.hpp>
-#include <mongocxx/exception/write_exception.hpp>
-#include <mongocxx/options/find_one_and_update.hpp>
+#include <mongocxx/hint.hpp>
+#include <mongocxx/model/update_one.hpp>
+#include <mongocxx/options/bulk_write.hpp>
+#include <mongocxx/options/delete.hpp>
+#include <mongocxx/options/find.hpp>
+#include <mongocxx/options/update.hpp>
+#include "../../compression.h"
 #include "exception.h"
 #include "json_utils.h"
 
@@ -14,11 +32,236 @@ using bsoncxx::builder::basic::kvp;
 using steelbox::entity_attribute_descriptor;
 using steelbox::entity_type_descriptor;
 
+namespace {
+
+	mongocxx::read_preference::read_mode read_mode_from_name(const std::string& name) {
+		if (name == "primary") {
+			return mongocxx::read_preference::read_mode::k_primary;
+		} else if (name == "primaryPreferred") {
+			return mongocxx::read_preference::read_mode::k_primary_preferred;
+		} else if (name == "secondary") {
+			return mongocxx::read_preference::read_mode::k_secondary;
+		} else if (name == "secondaryPreferred") {
+			return mongocxx::read_preference::read_mode::k_secondary_preferred;
+		} else if (name == "nearest") {
+			return mongocxx::read_preference::read_mode::k_nearest;
+		}
+
+		throw configuration_exception{ "unknown read preference mode" };
+	}
+
+	// named after its fields the way MongoDB names indexes by default, so that entity types
+	// sharing a collection and a reload changing the key attributes each get an index of their own
+	std::string key_index_name(const std::string& entity_type_name, const entity_type_descriptor& descriptor) {
+		std::string name{ "user_id_1" };
+		for (const entity_attribute_descriptor& attribute_descriptor : descriptor.key) {
+			name += "_" + entity_type_name + "_id." + attribute_descriptor.name + "_1";
+		}
+
+		return name;
+	}
+
+	std::string data_field_name(const std::string& path) {
+		return "data." + path;
+	}
+
+	// the index on a data path is named after its entity type and field so that queries can hint it
+	// and entity types sharing a collection do not take over each other's indexes
+	std::string data_index_name(const std::string& entity_type_name, const std::string& path) {
+		return entity_type_name + "." + data_field_name(path);
+	}
+
+	// whether both descriptors need the same indexes on the collection of their entity type
+	bool has_same_indexes(const entity_type_descriptor& first, const entity_type_descriptor& second) {
+		if (first.key.size() != second.key.size() || first.indexes.size() != second.indexes.size()) {
+			return false;
+		}
+		for (std::size_t i = 0; i < first.key.size(); ++i) {
+			if (first.key[i].name != second.key[i].name) {
+				return false;
+			}
+		}
+		for (std::size_t i = 0; i < first.indexes.size(); ++i) {
+			if (first.indexes[i].path != second.indexes[i].path || first.indexes[i].unique != second.indexes[i].unique) {
+				return false;
+			}
+		}
+
+		return first.time_to_live == second.time_to_live
+			&& (first.max_entities_per_user > 0) == (second.max_entities_per_user > 0);
+	}
+
+	// the filter of an entity type, null when the filters were built before
+	// the entity type was mapped to its current collection
+	steelbox::bloom_filter* find_entity_filter(
+		const known_entity_filters& filters,
+		const storage_snapshot& snapshot,
+		const std::string& entity_type_name
+	) {
+		const std::unordered_map<std::string, std::string>::const_iterator collection_it{ filters.collection_names.find(entity_type_name) };
+		if (collection_it == filters.collection_names.cend() || collection_it->second != snapshot.entity_collection_names_map.at(entity_type_name)) {
+			return nullptr;
+		}
+
+		return filters.entities.at(entity_type_name).get();
+	}
+
+	// whether the options of the uri set the given option, option names are case insensitive
+	bool has_uri_option(const std::string& uri, const std::string& option_name) {
+		const std::string::size_type options_position{ uri.find('?') };
+		if (options_position == std::string::npos) {
+			return false;
+		}
+
+		std::string options{ uri.substr(options_position) };
+		std::transform(options.begin(), options.end(), options.begin(), ::tolower);
+		std::string option{ option_name + "=" };
+		std::transform(option.begin(), option.end(), option.begin(), ::tolower);
+
+		return options.find("?" + option) != std::string::npos || options.find("&" + option) != std::string::npos;
+	}
+
+	// bounds server selection and socket reads by the longest deadline unless the uri sets them,
+	// the remaining operation budget is enforced per operation on top of these
+	std::string append_deadline_timeouts(const std::string& uri, const steelbox::storages::operation_deadlines& deadlines) {
+		if (deadlines.empty()) {
+			return uri;
+		}
+
+		std::chrono::milliseconds longest_deadline{ 0 };
+		for (const steelbox::storages::operation_deadlines::value_type& deadline : deadlines) {
+			longest_deadline = std::max(longest_deadline, deadline.second);
+		}
+
+		std::string bounded_uri{ uri };
+		const auto append_option = [&bounded_uri](const std::string& name, const std::chrono::milliseconds& value) {
+			if (has_uri_option(bounded_uri, name)) {
+				return;
+			}
+			bounded_uri += bounded_uri.find('?') == std::string::npos ? "?" : "&";
+			bounded_uri += name + "=" + std::to_string(value.count());
+		};
+		append_option("serverSelectionTimeoutMS", longest_deadline);
+		append_option("socketTimeoutMS", longest_deadline + socket_timeout_margin);
+
+		return bounded_uri;
+	}
+
+	// one find on a connection of its own, used by the attempts of hedged reads
+	std::vector<bsoncxx::document::value> find_documents(
+		mongocxx::pool& pool,
+		const std::string& db_name,
+		const std::string& collection_name,
+		const bsoncxx::document::view& filter,
+		const mongocxx::read_preference& read_preference,
+		const bsoncxx::stdx::optional<mongocxx::read_concern>& read_concern,
+		const operation_budget& budget
+	) {
+		mongocxx::pool::entry client{ budget.acquire(pool) };
+		mongocxx::collection entities{ (*client)[db_name][collection_name] };
+		entities.read_preference(read_preference);
+		if (read_concern) {
+			entities.read_concern(*read_concern);
+		}
+
+		mongocxx::options::find opts;
+		if (budget.is_limited()) {
+			opts.max_time(budget.remaining());
+		}
+		std::vector<bsoncxx::document::value> documents;
+		mongocxx::cursor entities_data = entities.find(filter, opts);
+		for (const bsoncxx::document::view& entity_data : entities_data) {
+			documents.emplace_back(entity_data);
+		}
+
+		return documents;
+	}
+
+	mongocxx::read_concern::level read_concern_level_from_name(const std::string& name) {
+		if (name == "local") {
+			return mongocxx::read_concern::level::k_local;
+		} else if (name == "available") {
+			return mongocxx::read_concern::level::k_available;
+		} else if (name == "majority") {
+			return mongocxx::read_concern::level::k_majority;
+		} else if (name == "linearizable") {
+			return mongocxx::read_concern::level::k_linearizable;
+		}
+
+		throw configuration_exception{ "unknown read concern level" };
+	}
+
+}
+
+read_settings::read_settings() :
+	hedged(false),
+	hedge_delay(0) {
+}
+
+compression_settings::compression_settings() :
+	codec(steelbox::compression_codec::zstd),
+	threshold(default_compression_threshold),
+	level(0) {
+}
+
+negative_lookup_settings::negative_lookup_settings() :
+	enabled(false),
+	false_positive_rate(0.01),
+	capacity_factor(2.0),
+	refresh_interval(600) {
+}
+
+storage_snapshot::storage_snapshot() :
+	export_batch_size(default_export_batch_size) {
+}
+
+operation_budget::operation_budget(const std::chrono::milliseconds& deadline) :
+	limited(deadline.count() > 0),
+	expiry(std::chrono::steady_clock::now() + deadline) {
+}
+
+bool operation_budget::is_limited() const {
+	return this->limited;
+}
+
+std::chrono::milliseconds operation_budget::remaining() const {
+	if (!this->limited) {
+		return std::chrono::milliseconds{ 0 };
+	}
+
+	const std::chrono::milliseconds left{
+		std::chrono::duration_cast<std::chrono::milliseconds>(this->expiry - std::chrono::steady_clock::now())
+	};
+	if (left.count() <= 0) {
+		throw operation_exception{ "operation deadline exceeded" };
+	}
+
+	return left;
+}
+
+mongocxx::pool::entry operation_budget::acquire(mongocxx::pool& pool) const {
+	if (!this->limited) {
+		return pool.acquire();
+	}
+
+	std::chrono::milliseconds retry_interval{ 1 };
+	while (true) {
+		bsoncxx::stdx::optional<mongocxx::pool::entry> client{ pool.try_acquire() };
+		if (client) {
+			return std::move(*client);
+		}
+
+		std::this_thread::sleep_for(std::min(retry_interval, this->remaining()));
+		retry_interval = std::min(retry_interval * 2, max_acquire_retry_interval);
+	}
+}
+
 storage::storage(
 	const steeljson::object& storage_config,
 	const std::unordered_map<std::string, entity_type_descriptor>& entity_types_map
 ) :
-	entity_types_map(entity_types_map) {
+	rebuilding_known_entities(false),
+	trim_interval(default_trim_interval) {
 	std::string config_storage_type;
 	try {
 		config_storage_type = storage_config.at("type").as<const std::string&>();
@@ -31,7 +274,11 @@ storage::storage(
 
 	mongocxx::uri uri;
 	try {
-		uri = mongocxx::uri{ storage_config.at("uri").as<const std::string&>() };
+		this->uri = storage_config.at("uri").as<const std::string&>();
+		// the pool outlives reloads, so the timeouts follow the deadlines the storage starts with
+		uri = mongocxx::uri{ append_deadline_timeouts(this->uri, read_operation_deadlines(storage_config)) };
+	} catch (const configuration_exception&) {
+		throw;
 	} catch (...) {
 		throw configuration_exception{ "invalid storage configuration" };
 	}
@@ -40,7 +287,7 @@ storage::storage(
 	}
 
 	try {
-		this->client = mongocxx::client{ uri };
+		this->pool = std::make_shared<mongocxx::pool>(uri);
 	} catch (const mongocxx::exception&) {
 		throw connection_exception{ "failed to create MongoDB client using provided uri" };
 	}
@@ -50,19 +297,117 @@ storage::storage(
 	}
 	this->db_name = uri.database();
 
-	steeljson::object collection_descriptors;;
-	try {
-		collection_descriptors = storage_config.at("collections").as<const steeljson::object&>();
-	} catch (...) {
-		throw configuration_exception{ "invalid storage configuration" };
+	std::int64_t hedged_read_threads{ default_hedged_read_threads };
+	if (storage_config.find("hedged_read_threads") != storage_config.end()) {
+		try {
+			hedged_read_threads = storage_config.at("hedged_read_threads").as<std::int64_t>();
+		} catch (...) {
+			throw configuration_exception{ "invalid storage configuration" };
+		}
+		if (hedged_read_threads <= 0) {
+			throw configuration_exception{ "hedged read threads must be positive" };
+		}
 	}
-	this->fill_entity_collection_names_map(collection_descriptors);
-	if (this->entity_types_map.size() != this->entity_collection_names_map.size()) {
-		throw configuration_exception{ "storage configuration has entity types with no associated collection" };
+	this->hedged_reads.reset(new thread_pool{ static_cast<std::size_t>(hedged_read_threads) });
+
+	if (storage_config.find("trim_interval") != storage_config.end()) {
+		try {
+			this->trim_interval = std::chrono::seconds{ storage_config.at("trim_interval").as<std::int64_t>() };
+		} catch (...) {
+			throw configuration_exception{ "invalid storage configuration" };
+		}
+		if (this->trim_interval.count() <= 0) {
+			throw configuration_exception{ "trim interval must be positive" };
+		}
+	}
+
+	if (storage_config.find("negative_lookup") != storage_config.end()) {
+		steeljson::object negative_lookup_descriptor;
+		try {
+			negative_lookup_descriptor = storage_config.at("negative_lookup").as<const steeljson::object&>();
+		} catch (...) {
+			throw configuration_exception{ "invalid storage configuration" };
+		}
+		this->read_negative_lookup_settings(negative_lookup_descriptor);
+	}
+
+	// changes made by other nodes keep the negative lookup filters current between rebuilds
+	bool watch_changes{ false };
+	std::chrono::milliseconds change_stream_retry_interval{ default_change_stream_retry_interval };
+	if (storage_config.find("change_stream") != storage_config.end()) {
+		try {
+			const steeljson::object& change_stream_descriptor{ storage_config.at("change_stream").as<const steeljson::object&>() };
+			if (change_stream_descriptor.find("retry_interval") != change_stream_descriptor.end()) {
+				change_stream_retry_interval = std::chrono::milliseconds{ change_stream_descriptor.at("retry_interval").as<std::int64_t>() };
+			}
+		} catch (...) {
+			throw configuration_exception{ "invalid change stream configuration" };
+		}
+		if (change_stream_retry_interval.count() <= 0) {
+			throw configuration_exception{ "change stream retry interval must be positive" };
+		}
+		if (!this->negative_lookup.enabled) {
+			throw configuration_exception{ "change stream requires negative lookup" };
+		}
+		watch_changes = true;
+	}
+	// without the changes of other nodes and tools the filters would answer 404 for their entities until the next rebuild
+	if (this->negative_lookup.enabled && !watch_changes) {
+		throw configuration_exception{ "negative lookup requires change stream" };
+	}
+
+	this->snapshot = this->create_snapshot(storage_config, entity_types_map);
+
+	// the users collection is provisioned alongside the entity types
+	std::future<void> users_provisioning{ std::async(std::launch::async, [this]() { this->create_users_collection(); }) };
+	std::vector<std::string> entity_type_names;
+	for (const std::unordered_map<std::string, std::string>::value_type& collection : this->snapshot->entity_collection_names_map) {
+		entity_type_names.push_back(collection.first);
 	}
+	this->create_entity_collections(*this->snapshot, entity_type_names);
+	users_provisioning.get();
 
-	this->create_users_collection();
-	this->create_entity_collections();
+	// opened before the filters are built so that no change made meanwhile is missed
+	if (watch_changes) {
+		try {
+			this->change_watcher.reset(new change_stream_watcher{
+				this->pool,
+				this->db_name,
+				this->watched_collection_names(*this->snapshot),
+				change_stream_retry_interval,
+				[this](const bsoncxx::document::view& change) { this->apply_change(change); },
+				[this]() {
+					// changes may have been missed, lookups go to MongoDB until the filters are rebuilt
+					std::atomic_store(&this->known_entities, std::shared_ptr<const known_entity_filters>{ });
+					this->rebuild_known_entities();
+				}
+			});
+		} catch (const mongocxx::exception&) {
+			throw connection_exception{ "failed to open change stream, MongoDB must run as a replica set" };
+		}
+	}
+
+	// the first build scans every collection, so it runs in the background
+	// and lookups go to MongoDB until it is done
+	if (this->negative_lookup.enabled) {
+		this->known_entities_refresh.reset(new periodic_task{
+			this->negative_lookup.refresh_interval,
+			[this]() { this->rebuild_known_entities(); },
+			true
+		});
+	}
+
+	// runs even without limited entity types, one may be added by reconfigure
+	this->trimming.reset(new periodic_task{
+		this->trim_interval,
+		[this]() { this->trim_entities(); }
+	});
+}
+
+storage::~storage() {
+	this->change_watcher.reset();
+	this->trimming.reset();
+	this->known_entities_refresh.reset();
 }
 
 std::vector<steeljson::value> storage::get(
@@ -70,177 +415,1196 @@ std::vector<steeljson::value> storage::get(
 	const std::string& entity_type_name,
 	const std::unordered_map<std::string, const boost::any>& entity_filter
 ) {
-	const mongocxx::database database{ this->client[this->db_name] };
+	const std::shared_ptr<const storage_snapshot> snapshot{ std::atomic_load(&this->snapshot) };
+	const entity_type_descriptor& descriptor{ snapshot->entity_types_map.at(entity_type_name) };
+	if (!this->is_known_user(username)) {
+		return { };
+	}
+	if (entity_filter.size() == descriptor.key.size() && !this->is_known_entity(*snapshot, username, entity_type_name, this->create_key_identity(descriptor, entity_filter))) {
+		return { };
+	}
+
+	const operation_budget budget{ this->find_deadline(*snapshot, storage_operation::get) };
+	const read_settings& settings{ this->find_read_settings(*snapshot, entity_type_name) };
+	// a hedged read takes connections for its attempts, so this one is released before
+	mongocxx::pool::entry client{ budget.acquire(*this->pool) };
 
 	bsoncxx::oid user_id;
-	if (!this->find_user_id_by_user_name(username, database, user_id)) {
+	if (!this->find_user_id_by_user_name(username, (*client)[this->db_name], settings, budget.remaining(), user_id)) {
 		return { };
 	}
 
 	const std::unordered_map<std::string, std::string>::const_iterator entity_types_it{
-		this->entity_collection_names_map.find(entity_type_name)
+		snapshot->entity_collection_names_map.find(entity_type_name)
 	};
-	if (entity_types_it == this->entity_collection_names_map.cend()) {
-		std::invalid_argument{ "collection for the given entity type does not exist" };
+	if (entity_types_it == snapshot->entity_collection_names_map.cend()) {
+		throw std::invalid_argument{ "collection for the given entity type does not exist" };
 	}
-	mongocxx::collection entities{ database[entity_types_it->second] };
 
 	document_builder filter;
 	filter.append(kvp("user_id", user_id));
 	for (const std::map<std::string, boost::any>::value_type& attribute : entity_filter) {
 		const std::vector<entity_attribute_descriptor>::const_iterator attribute_descriptor_cursor{
-			this->find_entity_attribute_descriptor_by_attribute_name(attribute.first, this->entity_types_map.at(entity_type_name).key)
+			this->find_entity_attribute_descriptor_by_attribute_name(attribute.first, snapshot->entity_types_map.at(entity_type_name).key)
 		};
 
-		if (attribute_descriptor_cursor != this->entity_types_map.at(entity_type_name).key.cend()) {
+		if (attribute_descriptor_cursor != snapshot->entity_types_map.at(entity_type_name).key.cend()) {
 			const std::string field_name{ entity_type_name + "_id" + "." + attribute.first };
-			switch (attribute_descriptor_cursor->type) {
+			this->append_key_attribute(filter, field_name, *attribute_descriptor_cursor, attribute.second);
+		}
+	}
+
+	std::vector<steeljson::value> result_set;
+	if (settings.hedged) {
+		client.reset();
+		const std::vector<bsoncxx::document::value> entities_data{ this->hedged_find(entity_types_it->second, filter.extract(), settings, budget) };
+
+		for (const bsoncxx::document::value& entity_data : entities_data) {
+			if (!entity_data.view()["data"]) {
+				throw data_exception{ "entity document must contain data field" };
+			}
+
+			result_set.push_back(this->read_entity_data(entity_data.view()));
+		}
+
+		return result_set;
+	}
+
+	mongocxx::collection entities{ (*client)[this->db_name][entity_types_it->second] };
+	entities.read_preference(settings.read_preference);
+	if (settings.read_concern) {
+		entities.read_concern(*settings.read_concern);
+	}
+	mongocxx::options::find opts;
+	if (budget.is_limited()) {
+		opts.max_time(budget.remaining());
+	}
+	mongocxx::cursor entities_data = entities.find(filter.view(), opts); // TODO: add projection
+
+	for (const bsoncxx::document::view& entity_data : entities_data) {
+		if (!entity_data["data"]) {
+			throw data_exception{ "entity document must contain data field" };
+		}
+
+		result_set.push_back(this->read_entity_data(entity_data));
+	}
+
+	return result_set;
+}
+
+std::vector<boost::optional<steeljson::value>> storage::get_many(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::vector<std::unordered_map<std::string, const boost::any>>& entity_keys
+) {
+	const std::shared_ptr<const storage_snapshot> snapshot{ std::atomic_load(&this->snapshot) };
+	std::vector<boost::optional<steeljson::value>> result_set(entity_keys.size());
+	if (entity_keys.empty() || !this->is_known_user(username)) {
+		return result_set;
+	}
+
+	const operation_budget budget{ this->find_deadline(*snapshot, storage_operation::get_many) };
+	const read_settings& settings{ this->find_read_settings(*snapshot, entity_type_name) };
+	mongocxx::pool::entry client{ budget.acquire(*this->pool) };
+	const mongocxx::database database{ (*client)[this->db_name] };
+
+	bsoncxx::oid user_id;
+	if (!this->find_user_id_by_user_name(username, database, settings, budget.remaining(), user_id)) {
+		return result_set;
+	}
+
+	const std::unordered_map<std::string, std::string>::const_iterator entity_types_it{
+		snapshot->entity_collection_names_map.find(entity_type_name)
+	};
+	if (entity_types_it == snapshot->entity_collection_names_map.cend()) {
+		throw std::invalid_argument{ "collection for the given entity type does not exist" };
+	}
+	mongocxx::collection entities{ database[entity_types_it->second] };
+	entities.read_preference(settings.read_preference);
+	if (settings.read_concern) {
+		entities.read_concern(*settings.read_concern);
+	}
+
+	const entity_type_descriptor& descriptor{ snapshot->entity_types_map.at(entity_type_name) };
+	const std::string key_field_name{ entity_type_name + "_id" };
+
+	// positions of the requested keys, several requests may ask for the same entity
+	std::unordered_multimap<std::string, std::size_t> requested_positions;
+	for (std::size_t i = 0; i < entity_keys.size(); ++i) {
+		requested_positions.insert(std::make_pair(this->create_key_identity(descriptor, entity_keys[i]), i));
+	}
+
+	document_builder filter;
+	filter.append(kvp("user_id", user_id));
+	if (descriptor.key.size() == 1) {
+		const entity_attribute_descriptor& attribute_descriptor{ descriptor.key[0] };
+		document_builder in_values;
+		bsoncxx::builder::basic::array values;
+		for (const std::unordered_map<std::string, const boost::any>& entity_key : entity_keys) {
+			const boost::any& value{ entity_key.at(attribute_descriptor.name) };
+			switch (attribute_descriptor.type) {
 				case entity_attribute_type::integer: {
-					filter.append(kvp(field_name, boost::any_cast<std::int64_t>(attribute.second)));
+					values.append(boost::any_cast<std::int64_t>(value));
 					break;
 				}
 				case entity_attribute_type::floating_point: {
-					filter.append(kvp(field_name, boost::any_cast<float>(attribute.second)));
+					values.append(boost::any_cast<float>(value));
 					break;
 				}
 				case entity_attribute_type::string: {
-					filter.append(kvp(field_name, boost::any_cast<std::string>(attribute.second)));
+					values.append(boost::any_cast<std::string>(value));
 					break;
 				}
 			}
 		}
+		in_values.append(kvp("$in", values.extract()));
+		filter.append(kvp(key_field_name + "." + attribute_descriptor.name, in_values.extract()));
+	} else {
+		bsoncxx::builder::basic::array alternatives;
+		for (const std::unordered_map<std::string, const boost::any>& entity_key : entity_keys) {
+			document_builder alternative;
+			for (const entity_attribute_descriptor& attribute_descriptor : descriptor.key) {
+				this->append_key_attribute(alternative, key_field_name + "." + attribute_descriptor.name, attribute_descriptor, entity_key.at(attribute_descriptor.name));
+			}
+			alternatives.append(alternative.extract());
+		}
+		filter.append(kvp("$or", alternatives.extract()));
 	}
 
-	mongocxx::cursor entities_data = entities.find(filter.view()); // TODO: add projection
+	document_builder projection;
+	projection.append(kvp("_id", 0));
+	projection.append(kvp(key_field_name, 1));
+	projection.append(kvp("data", 1));
+	projection.append(kvp(data_codec_field_name, 1));
 
-	std::vector<steeljson::value> result_set;
+	mongocxx::options::find opts;
+	opts.projection(projection.extract());
+	if (budget.is_limited()) {
+		opts.max_time(budget.remaining());
+	}
+
+	mongocxx::cursor entities_data = entities.find(filter.view(), opts);
 	for (const bsoncxx::document::view& entity_data : entities_data) {
-		if (!entity_data["data"]) {
-			throw data_exception{ "entity document must contain data field" };
+		if (!entity_data[key_field_name] || !entity_data["data"]) {
+			throw data_exception{ "entity document must contain key and data fields" };
+		}
+
+		const std::string key_identity{ this->create_key_identity(descriptor, entity_data[key_field_name].get_document().value) };
+		const std::pair<std::unordered_multimap<std::string, std::size_t>::const_iterator, std::unordered_multimap<std::string, std::size_t>::const_iterator> positions{
+			requested_positions.equal_range(key_identity)
+		};
+		if (positions.first == positions.second) {
+			continue;
 		}
 
-		result_set.push_back(build_json(entity_data["data"].get_value()));
+		const steeljson::value data{ this->read_entity_data(entity_data) };
+		for (std::unordered_multimap<std::string, std::size_t>::const_iterator position_it = positions.first; position_it != positions.second; ++position_it) {
+			result_set[position_it->second] = data;
+		}
 	}
 
 	return result_set;
 }
 
-void storage::put(
+std::vector<steelbox::storages::entity> storage::list(
 	const std::string& username,
 	const std::string& entity_type_name,
-	const std::unordered_map<std::string, const boost::any>& entity_key,
-	const steeljson::value& data
+	const std::unordered_map<std::string, const boost::any>& key_prefix,
+	const std::vector<boost::any>& after,
+	std::size_t limit
 ) {
-	const mongocxx::database database{ this->client[this->db_name] };
+	const std::shared_ptr<const storage_snapshot> snapshot{ std::atomic_load(&this->snapshot) };
+	const operation_budget budget{ this->find_deadline(*snapshot, storage_operation::list) };
+	const read_settings& settings{ this->find_read_settings(*snapshot, entity_type_name) };
+	mongocxx::pool::entry client{ budget.acquire(*this->pool) };
+	const mongocxx::database database{ (*client)[this->db_name] };
 
 	bsoncxx::oid user_id;
-	if (!this->find_user_id_by_user_name(username, database, user_id)) {
-		throw steelbox::user_not_found_exception();
+	if (!this->find_user_id_by_user_name(username, database, settings, budget.remaining(), user_id)) {
+		return { };
 	}
 
 	const std::unordered_map<std::string, std::string>::const_iterator entity_types_it{
-		this->entity_collection_names_map.find(entity_type_name)
+		snapshot->entity_collection_names_map.find(entity_type_name)
 	};
-	if (entity_types_it == this->entity_collection_names_map.cend()) {
-		std::invalid_argument{ "collection for the given entity type does not exist" };
+	if (entity_types_it == snapshot->entity_collection_names_map.cend()) {
+		throw std::invalid_argument{ "collection for the given entity type does not exist" };
 	}
 	mongocxx::collection entities{ database[entity_types_it->second] };
+	entities.read_preference(settings.read_preference);
+	if (settings.read_concern) {
+		entities.read_concern(*settings.read_concern);
+	}
 
-	document_builder document;
-	document.append(kvp("user_id", user_id));
-	document.append(kvp(entity_type_name + "_id", this->create_key_document(entity_type_name, entity_key)));
+	const std::vector<entity_attribute_descriptor>& key_descriptor{ snapshot->entity_types_map.at(entity_type_name).key };
+	const std::string key_field_name{ entity_type_name + "_id" };
+	const std::size_t prefix_size{ key_prefix.size() };
+	if (prefix_size > key_descriptor.size() || (!after.empty() && after.size() != key_descriptor.size() - prefix_size)) {
+		throw std::invalid_argument{ "invalid key prefix" };
+	}
 
-	document_builder set_params;
-	append_json_to_document(set_params, "data", data);
-	document_builder update_document;
-	update_document.append(kvp("$set", set_params));
+	document_builder filter;
+	filter.append(kvp("user_id", user_id));
+	this->append_entity_type_condition(filter, entity_type_name);
+	for (std::size_t i = 0; i < prefix_size; ++i) {
+		if (key_prefix.count(key_descriptor[i].name) == 0) {
+			throw std::invalid_argument{ "key prefix must contain the leading key attributes" };
+		}
+		this->append_key_attribute(filter, key_field_name + "." + key_descriptor[i].name, key_descriptor[i], key_prefix.at(key_descriptor[i].name));
+	}
 
-	mongocxx::options::find_one_and_update opts;
-	opts.upsert(true);
+	this->append_key_after(filter, key_field_name, key_descriptor, prefix_size, after);
 
-	try {
-		entities.find_one_and_update(document.view(), update_document.view(), opts);
-	} catch (const mongocxx::write_exception&) {
-		throw operation_exception{ "insert operation failed" };
+	// sorting on the whole key lets the user_id/key index serve both the filter and the order
+	document_builder sort;
+	for (const entity_attribute_descriptor& attribute_descriptor : key_descriptor) {
+		sort.append(kvp(key_field_name + "." + attribute_descriptor.name, 1));
 	}
-}
-/*
-void storage::patch(
-	const std::string& username,
-	const std::string& entity_type_name,
-	const std::unordered_map<std::string, boost::any>& entity_key,
-	const steeljson::patch& patch
-) {
 
+	document_builder projection;
+	projection.append(kvp("_id", 0));
+	projection.append(kvp(key_field_name, 1));
+	projection.append(kvp("data", 1));
+	projection.append(kvp(data_codec_field_name, 1));
 
-}
-*/
-bool storage::database_exists(const std::string& name) const {
-	try {
-		mongocxx::cursor databases{ this->client.list_databases() };
+	mongocxx::options::find opts;
+	opts.sort(sort.extract());
+	opts.projection(projection.extract());
+	opts.limit(static_cast<std::int32_t>(limit));
+	if (budget.is_limited()) {
+		opts.max_time(budget.remaining());
+	}
 
-		for (const bsoncxx::document::view& database : databases) {
-			const bsoncxx::stdx::string_view database_name{ database["name"].get_utf8() };
-			if (static_cast<std::string>(database_name) == name) {
-				return true;
-			}
+	std::vector<entity> result_set;
+	mongocxx::cursor entities_data = entities.find(filter.view(), opts);
+	for (const bsoncxx::document::view& entity_data : entities_data) {
+		if (!entity_data[key_field_name] || !entity_data["data"]) {
+			throw data_exception{ "entity document must contain key and data fields" };
 		}
-	} catch (const mongocxx::operation_exception&) {
-		throw connection_exception{ "failed to access list of databases" };
+
+		entity listed_entity;
+		listed_entity.key = build_json(entity_data[key_field_name].get_value());
+		listed_entity.data = this->read_entity_data(entity_data);
+		result_set.push_back(std::move(listed_entity));
 	}
 
-	return false;
+	return result_set;
 }
 
-void storage::fill_entity_collection_names_map(const steeljson::object& collection_descriptors) {
-	for (const steeljson::object::value_type& collection_descriptor : collection_descriptors) {
-		if (this->entity_types_map.count(collection_descriptor.first) == 0) {
-			throw configuration_exception{ "unknown entity type" };
+std::vector<steelbox::storages::entity> storage::query(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::vector<data_predicate>& predicates,
+	std::size_t limit
+) {
+	const std::shared_ptr<const storage_snapshot> snapshot{ std::atomic_load(&this->snapshot) };
+	const entity_type_descriptor& descriptor{ snapshot->entity_types_map.at(entity_type_name) };
+	if (predicates.empty()) {
+		throw std::invalid_argument{ "query must have at least one predicate" };
+	}
+
+	// predicates on the same path are combined into one condition document
+	std::vector<std::string> paths;
+	std::unordered_map<std::string, std::vector<const data_predicate*>> path_predicates;
+	for (const data_predicate& predicate : predicates) {
+		if (descriptor.find_index(predicate.path) == descriptor.indexes.cend()) {
+			throw std::invalid_argument{ "query predicates must only use indexed paths" };
 		}
-		try {
-			this->entity_collection_names_map.insert(std::make_pair(collection_descriptor.first, collection_descriptor.second.as<const std::string&>()));
-		} catch (...) {
-			throw configuration_exception{ "invalid storage configuration" };
+		if (path_predicates.count(predicate.path) == 0) {
+			paths.push_back(predicate.path);
 		}
+		path_predicates[predicate.path].push_back(&predicate);
 	}
-}
-
-void storage::create_users_collection() {
-	mongocxx::database database{ this->client[this->db_name] };
 
-	if (!database.has_collection(users_collection_name)) {
-		try {
-			database.create_collection(users_collection_name);
-		} catch (const mongocxx::operation_exception&) {
-			throw operation_exception{ std::string("failed to create collection ") + users_collection_name };
-		}
+	if (!this->is_known_user(username)) {
+		return { };
 	}
-}
 
-void storage::create_entity_collections() {
-	mongocxx::database database{ this->client[this->db_name] };
+	const operation_budget budget{ this->find_deadline(*snapshot, storage_operation::query) };
+	const read_settings& settings{ this->find_read_settings(*snapshot, entity_type_name) };
+	mongocxx::pool::entry client{ budget.acquire(*this->pool) };
+	const mongocxx::database database{ (*client)[this->db_name] };
 
-	for (const std::unordered_map<std::string, std::string>::value_type& collection : this->entity_collection_names_map) {
-		if (!database.has_collection(collection.second)) {
-			try {
-				database.create_collection(collection.second);
-			} catch (const mongocxx::operation_exception&) {
-				throw operation_exception{ "failed to create collection with the given name" };
-			}
-		}
+	bsoncxx::oid user_id;
+	if (!this->find_user_id_by_user_name(username, database, settings, budget.remaining(), user_id)) {
+		return { };
 	}
-}
 
-bool storage::find_user_id_by_user_name(
-	const std::string& name,
-	const mongocxx::database& database,
-	bsoncxx::oid& id
-) const {
-	mongocxx::collection users{ database[users_collection_name] };
+	const std::unordered_map<std::string, std::string>::const_iterator entity_types_it{
+		snapshot->entity_collection_names_map.find(entity_type_name)
+	};
+	if (entity_types_it == snapshot->entity_collection_names_map.cend()) {
+		throw std::invalid_argument{ "collection for the given entity type does not exist" };
+	}
+	mongocxx::collection entities{ database[entity_types_it->second] };
+	entities.read_preference(settings.read_preference);
+	if (settings.read_concern) {
+		entities.read_concern(*settings.read_concern);
+	}
+
+	document_builder filter;
+	filter.append(kvp("user_id", user_id));
+	this->append_entity_type_condition(filter, entity_type_name);
+	for (const std::string& path : paths) {
+		const entity_attribute_descriptor value_descriptor{ path, descriptor.find_index(path)->type };
+
+		document_builder conditions;
+		for (const data_predicate* predicate : path_predicates.at(path)) {
+			std::string operator_name;
+			switch (predicate->comparison) {
+				case comparison_operator::equal: {
+					operator_name = "$eq";
+					break;
+				}
+				case comparison_operator::greater: {
+					operator_name = "$gt";
+					break;
+				}
+				case comparison_operator::greater_or_equal: {
+					operator_name = "$gte";
+					break;
+				}
+				case comparison_operator::less: {
+					operator_name = "$lt";
+					break;
+				}
+				case comparison_operator::less_or_equal: {
+					operator_name = "$lte";
+					break;
+				}
+			}
+			this->append_key_attribute(conditions, operator_name, value_descriptor, predicate->value);
+		}
+		filter.append(kvp(data_field_name(path), conditions.extract()));
+	}
+
+	const std::string key_field_name{ entity_type_name + "_id" };
+	document_builder projection;
+	projection.append(kvp("_id", 0));
+	projection.append(kvp(key_field_name, 1));
+	projection.append(kvp("data", 1));
+	projection.append(kvp(data_codec_field_name, 1));
+
+	// the hint makes MongoDB fail rather than fall back to a collection scan
+	mongocxx::options::find opts;
+	opts.projection(projection.extract());
+	opts.limit(static_cast<std::int32_t>(limit));
+	opts.hint(mongocxx::hint{ data_index_name(entity_type_name, paths.front()) });
+	if (budget.is_limited()) {
+		opts.max_time(budget.remaining());
+	}
+
+	std::vector<entity> result_set;
+	mongocxx::cursor entities_data = entities.find(filter.view(), opts);
+	for (const bsoncxx::document::view& entity_data : entities_data) {
+		if (!entity_data[key_field_name] || !entity_data["data"]) {
+			throw data_exception{ "entity document must contain key and data fields" };
+		}
+
+		entity found_entity;
+		found_entity.key = build_json(entity_data[key_field_name].get_value());
+		found_entity.data = this->read_entity_data(entity_data);
+		result_set.push_back(std::move(found_entity));
+	}
+
+	return result_set;
+}
+
+void storage::put(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::unordered_map<std::string, const boost::any>& entity_key,
+	const steeljson::value& data
+) {
+	const std::shared_ptr<const storage_snapshot> snapshot{ std::atomic_load(&this->snapshot) };
+	const operation_budget budget{ this->find_deadline(*snapshot, storage_operation::put) };
+	mongocxx::pool::entry client{ budget.acquire(*this->pool) };
+	const mongocxx::database database{ (*client)[this->db_name] };
+
+	bsoncxx::oid user_id;
+	if (!this->find_user_id_by_user_name(username, database, this->default_read_settings, budget.remaining(), user_id)) {
+		throw steelbox::user_not_found_exception();
+	}
+
+	const std::unordered_map<std::string, std::string>::const_iterator entity_types_it{
+		snapshot->entity_collection_names_map.find(entity_type_name)
+	};
+	if (entity_types_it == snapshot->entity_collection_names_map.cend()) {
+		throw std::invalid_argument{ "collection for the given entity type does not exist" };
+	}
+	mongocxx::collection entities{ database[entity_types_it->second] };
+
+	const bsoncxx::document::value document{ this->create_entity_filter(*snapshot, user_id, entity_type_name, entity_key) };
+	const bsoncxx::document::value update_document{ this->create_entity_update(*snapshot, entity_type_name, data) };
+
+	mongocxx::options::update opts;
+	opts.upsert(true);
+	opts.write_concern(this->find_write_concern(*snapshot, entity_type_name, budget.remaining(), entities.write_concern()));
+
+	try {
+		entities.update_one(document.view(), update_document.view(), opts);
+	} catch (const mongocxx::operation_exception& e) {
+		if (e.code().value() == duplicate_key_error_code) {
+			throw steelbox::duplicate_value_exception{ "data violates a unique index" };
+		}
+		throw operation_exception{ "insert operation failed" };
+	}
+
+	if (this->negative_lookup.enabled) {
+		this->remember_entity(*snapshot, username, entity_type_name, this->create_key_identity(snapshot->entity_types_map.at(entity_type_name), entity_key));
+	}
+	this->remember_untrimmed_user(*snapshot, entity_type_name, user_id);
+}
+
+void storage::put_many(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::vector<std::pair<std::unordered_map<std::string, const boost::any>, steeljson::value>>& entities_data
+) {
+	const std::shared_ptr<const storage_snapshot> snapshot{ std::atomic_load(&this->snapshot) };
+	if (entities_data.empty()) {
+		return;
+	}
+
+	const operation_budget budget{ this->find_deadline(*snapshot, storage_operation::put_many) };
+	mongocxx::pool::entry client{ budget.acquire(*this->pool) };
+	const mongocxx::database database{ (*client)[this->db_name] };
+
+	bsoncxx::oid user_id;
+	if (!this->find_user_id_by_user_name(username, database, this->default_read_settings, budget.remaining(), user_id)) {
+		throw steelbox::user_not_found_exception();
+	}
+
+	const std::unordered_map<std::string, std::string>::const_iterator entity_types_it{
+		snapshot->entity_collection_names_map.find(entity_type_name)
+	};
+	if (entity_types_it == snapshot->entity_collection_names_map.cend()) {
+		throw std::invalid_argument{ "collection for the given entity type does not exist" };
+	}
+	mongocxx::collection entities{ database[entity_types_it->second] };
+
+	mongocxx::options::bulk_write opts;
+	opts.ordered(false);
+	opts.write_concern(this->find_write_concern(*snapshot, entity_type_name, budget.remaining(), entities.write_concern()));
+
+	mongocxx::bulk_write bulk{ opts };
+	for (const std::pair<std::unordered_map<std::string, const boost::any>, steeljson::value>& entity : entities_data) {
+		mongocxx::model::update_one upsert{
+			this->create_entity_filter(*snapshot, user_id, entity_type_name, entity.first),
+			this->create_entity_update(*snapshot, entity_type_name, entity.second)
+		};
+		upsert.upsert(true);
+		bulk.append(upsert);
+	}
+
+	std::vector<std::size_t> failed_indexes;
+	try {
+		entities.bulk_write(bulk);
+	} catch (const mongocxx::bulk_write_exception& e) {
+		failed_indexes = this->find_failed_writes(e);
+	} catch (const mongocxx::operation_exception&) {
+		throw operation_exception{ "bulk insert operation failed" };
+	}
+
+	std::vector<bool> failed(entities_data.size(), false);
+	for (std::size_t index : failed_indexes) {
+		if (index >= failed.size()) {
+			throw operation_exception{ "bulk insert operation failed" };
+		}
+		failed[index] = true;
+	}
+	if (this->negative_lookup.enabled) {
+		const entity_type_descriptor& descriptor{ snapshot->entity_types_map.at(entity_type_name) };
+		for (std::size_t i = 0; i < entities_data.size(); ++i) {
+			if (!failed[i]) {
+				this->remember_entity(*snapshot, username, entity_type_name, this->create_key_identity(descriptor, entities_data[i].first));
+			}
+		}
+	}
+	this->remember_untrimmed_user(*snapshot, entity_type_name, user_id);
+
+	if (!failed_indexes.empty()) {
+		throw steelbox::partial_write_exception{ "bulk insert operation failed partially", failed_indexes };
+	}
+}
+
+void storage::export_entities(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::string& after_entity_type_name,
+	const std::vector<boost::any>& after,
+	std::size_t limit,
+	const entity_consumer& consumer
+) {
+	const std::shared_ptr<const storage_snapshot> snapshot{ std::atomic_load(&this->snapshot) };
+	const operation_budget budget{ this->find_deadline(*snapshot, storage_operation::export_entities) };
+	mongocxx::pool::entry client{ budget.acquire(*this->pool) };
+	const mongocxx::database database{ (*client)[this->db_name] };
+
+	std::vector<std::string> entity_type_names;
+	if (entity_type_name.empty()) {
+		for (const std::unordered_map<std::string, std::string>::value_type& collection : snapshot->entity_collection_names_map) {
+			entity_type_names.push_back(collection.first);
+		}
+		// a fixed type order lets an export resume after any entity
+		std::sort(entity_type_names.begin(), entity_type_names.end());
+	} else {
+		if (snapshot->entity_collection_names_map.count(entity_type_name) == 0) {
+			throw std::invalid_argument{ "collection for the given entity type does not exist" };
+		}
+		entity_type_names.push_back(entity_type_name);
+	}
+	if (!after_entity_type_name.empty()) {
+		const std::unordered_map<std::string, entity_type_descriptor>::const_iterator after_entity_type_it{
+			snapshot->entity_types_map.find(after_entity_type_name)
+		};
+		if (after_entity_type_it == snapshot->entity_types_map.cend() || after.size() != after_entity_type_it->second.key.size()) {
+			throw std::invalid_argument{ "invalid export position" };
+		}
+	}
+
+	bsoncxx::oid user_id;
+	if (!this->find_user_id_by_user_name(username, database, this->default_read_settings, budget.remaining(), user_id)) {
+		throw steelbox::user_not_found_exception();
+	}
+
+	std::size_t remaining{ limit };
+	for (const std::string& exported_entity_type_name : entity_type_names) {
+		if (remaining == 0) {
+			break;
+		}
+		if (exported_entity_type_name < after_entity_type_name) {
+			continue;
+		}
+
+		const std::vector<entity_attribute_descriptor>& key_descriptor{ snapshot->entity_types_map.at(exported_entity_type_name).key };
+		const std::string key_field_name{ exported_entity_type_name + "_id" };
+		const read_settings& settings{ this->find_read_settings(*snapshot, exported_entity_type_name) };
+		mongocxx::collection entities{ database[snapshot->entity_collection_names_map.at(exported_entity_type_name)] };
+		entities.read_preference(settings.read_preference);
+		if (settings.read_concern) {
+			entities.read_concern(*settings.read_concern);
+		}
+
+		document_builder filter;
+		filter.append(kvp("user_id", user_id));
+		this->append_entity_type_condition(filter, exported_entity_type_name);
+		if (exported_entity_type_name == after_entity_type_name) {
+			this->append_key_after(filter, key_field_name, key_descriptor, 0, after);
+		}
+
+		// sorting on the whole key lets the user_id/key index serve both the filter and the order
+		document_builder sort;
+		for (const entity_attribute_descriptor& attribute_descriptor : key_descriptor) {
+			sort.append(kvp(key_field_name + "." + attribute_descriptor.name, 1));
+		}
+
+		document_builder projection;
+		projection.append(kvp("_id", 0));
+		projection.append(kvp(key_field_name, 1));
+		projection.append(kvp("data", 1));
+		projection.append(kvp(data_codec_field_name, 1));
+
+		mongocxx::options::find opts;
+		opts.sort(sort.extract());
+		opts.projection(projection.extract());
+		opts.limit(static_cast<std::int32_t>(remaining));
+		opts.batch_size(snapshot->export_batch_size);
+		if (budget.is_limited()) {
+			opts.max_time(budget.remaining());
+		}
+
+		// documents are converted one at a time so memory stays bounded by the cursor batch
+		mongocxx::cursor entities_data = entities.find(filter.view(), opts);
+		for (const bsoncxx::document::view& entity_data : entities_data) {
+			if (!entity_data[key_field_name] || !entity_data["data"]) {
+				throw data_exception{ "entity document must contain key and data fields" };
+			}
+
+			consumer(
+				exported_entity_type_name,
+				build_json(entity_data[key_field_name].get_value()),
+				this->read_entity_data(entity_data)
+			);
+			--remaining;
+		}
+	}
+}
+
+void storage::reconfigure(
+	const steeljson::object& storage_config,
+	const std::unordered_map<std::string, entity_type_descriptor>& entity_types_map
+) {
+	try {
+		if (storage_config.at("type").as<const std::string&>() != storage_type) {
+			throw configuration_exception{ "storage type mismatch" };
+		}
+		if (storage_config.at("uri").as<const std::string&>() != this->uri) {
+			throw configuration_exception{ "storage uri can not change without a restart" };
+		}
+	} catch (const configuration_exception&) {
+		throw;
+	} catch (...) {
+		throw configuration_exception{ "invalid storage configuration" };
+	}
+
+	const std::shared_ptr<const storage_snapshot> next_snapshot{ this->create_snapshot(storage_config, entity_types_map) };
+
+	std::lock_guard<std::mutex> lock{ this->reconfigure_mutex };
+	const std::shared_ptr<const storage_snapshot> current_snapshot{ std::atomic_load(&this->snapshot) };
+
+	// only entity types whose collection or indexes changed are provisioned,
+	// before any request can use them through the new snapshot
+	std::vector<std::string> changed_entity_type_names;
+	for (const std::unordered_map<std::string, std::string>::value_type& collection : next_snapshot->entity_collection_names_map) {
+		const std::unordered_map<std::string, std::string>::const_iterator current_collection_it{
+			current_snapshot->entity_collection_names_map.find(collection.first)
+		};
+		const bool provisioned{
+			current_collection_it != current_snapshot->entity_collection_names_map.cend() &&
+			current_collection_it->second == collection.second &&
+			has_same_indexes(current_snapshot->entity_types_map.at(collection.first), next_snapshot->entity_types_map.at(collection.first))
+		};
+		if (!provisioned) {
+			changed_entity_type_names.push_back(collection.first);
+		}
+	}
+	this->create_entity_collections(*next_snapshot, changed_entity_type_names);
+
+	std::atomic_store(&this->snapshot, next_snapshot);
+
+	if (this->change_watcher) {
+		this->change_watcher->watch(this->watched_collection_names(*next_snapshot));
+	}
+}
+
+void storage::warm_up(std::size_t connections, const std::vector<std::string>& usernames) {
+	// every connection is held until it is warm, so the pool can not hand the same one out twice
+	std::atomic<std::size_t> next_user{ 0 };
+	std::vector<std::future<void>> warmers;
+	for (std::size_t i = 0; i < std::max<std::size_t>(connections, 1); ++i) {
+		warmers.push_back(std::async(std::launch::async, [this, &usernames, &next_user]() {
+			mongocxx::pool::entry client{ this->pool->acquire() };
+			mongocxx::database database{ (*client)[this->db_name] };
+
+			document_builder ping;
+			ping.append(kvp("ping", 1));
+			database.run_command(ping.extract());
+
+			bsoncxx::oid user_id;
+			for (std::size_t user = next_user++; user < usernames.size(); user = next_user++) {
+				this->find_user_id_by_user_name(usernames[user], database, this->default_read_settings, std::chrono::milliseconds{ 0 }, user_id);
+			}
+		}));
+	}
+
+	for (std::future<void>& warmer : warmers) {
+		warmer.get();
+	}
+}
+
+/*
+void storage::patch(
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::unordered_map<std::string, boost::any>& entity_key,
+	const steeljson::patch& patch
+) {
+
+
+}
+*/
+bool storage::database_exists(const std::string& name) const {
+	try {
+		mongocxx::pool::entry client{ this->pool->acquire() };
+		mongocxx::cursor databases{ client->list_databases() };
+
+		for (const bsoncxx::document::view& database : databases) {
+			const bsoncxx::stdx::string_view database_name{ database["name"].get_utf8() };
+			if (static_cast<std::string>(database_name) == name) {
+				return true;
+			}
+		}
+	} catch (const mongocxx::operation_exception&) {
+		throw connection_exception{ "failed to access list of databases" };
+	}
+
+	return false;
+}
+
+std::shared_ptr<const storage_snapshot> storage::create_snapshot(
+	const steeljson::object& storage_config,
+	const std::unordered_map<std::string, entity_type_descriptor>& entity_types_map
+) const {
+	const std::shared_ptr<storage_snapshot> snapshot{ std::make_shared<storage_snapshot>() };
+	snapshot->entity_types_map = entity_types_map;
+
+	steeljson::object collection_descriptors;
+	try {
+		collection_descriptors = storage_config.at("collections").as<const steeljson::object&>();
+	} catch (...) {
+		throw configuration_exception{ "invalid storage configuration" };
+	}
+	this->fill_entity_collection_names_map(*snapshot, collection_descriptors);
+	if (snapshot->entity_types_map.size() != snapshot->entity_collection_names_map.size()) {
+		throw configuration_exception{ "storage configuration has entity types with no associated collection" };
+	}
+
+	if (storage_config.find("read_preferences") != storage_config.end()) {
+		steeljson::object read_preference_descriptors;
+		try {
+			read_preference_descriptors = storage_config.at("read_preferences").as<const steeljson::object&>();
+		} catch (...) {
+			throw configuration_exception{ "invalid storage configuration" };
+		}
+		this->fill_entity_read_settings_map(*snapshot, read_preference_descriptors);
+	}
+
+	if (storage_config.find("export_batch_size") != storage_config.end()) {
+		try {
+			snapshot->export_batch_size = storage_config.at("export_batch_size").as<std::int32_t>();
+		} catch (...) {
+			throw configuration_exception{ "invalid storage configuration" };
+		}
+		if (snapshot->export_batch_size <= 0) {
+			throw configuration_exception{ "export batch size must be positive" };
+		}
+	}
+
+	for (const std::unordered_map<std::string, entity_type_descriptor>::value_type& entity_type : snapshot->entity_types_map) {
+		if (entity_type.second.max_entities_per_user > static_cast<std::size_t>(std::numeric_limits<std::int32_t>::max())) {
+			throw configuration_exception{ "maximum number of entities per user is too large" };
+		}
+
+		// a time to live index expires every document of its collection whatever its entity type
+		if (entity_type.second.time_to_live.count() > 0) {
+			const std::string& collection_name{ snapshot->entity_collection_names_map.at(entity_type.first) };
+			for (const std::unordered_map<std::string, std::string>::value_type& collection : snapshot->entity_collection_names_map) {
+				if (collection.first != entity_type.first && collection.second == collection_name) {
+					throw configuration_exception{ "entity types with a time to live must not share their collection" };
+				}
+			}
+		}
+	}
+
+	snapshot->deadlines = read_operation_deadlines(storage_config);
+
+	for (const std::unordered_map<std::string, entity_type_descriptor>::value_type& entity_type : snapshot->entity_types_map) {
+		snapshot->entity_write_concerns_map.insert(std::make_pair(entity_type.first, this->create_write_concern(entity_type.second.durability)));
+	}
+
+	if (storage_config.find("compression") != storage_config.end()) {
+		steeljson::object compression_descriptors;
+		try {
+			compression_descriptors = storage_config.at("compression").as<const steeljson::object&>();
+		} catch (...) {
+			throw configuration_exception{ "invalid storage configuration" };
+		}
+		this->fill_entity_compression_map(*snapshot, compression_descriptors);
+	}
+
+	return snapshot;
+}
+
+void storage::fill_entity_collection_names_map(storage_snapshot& snapshot, const steeljson::object& collection_descriptors) const {
+	for (const steeljson::object::value_type& collection_descriptor : collection_descriptors) {
+		if (snapshot.entity_types_map.count(collection_descriptor.first) == 0) {
+			throw configuration_exception{ "unknown entity type" };
+		}
+		try {
+			snapshot.entity_collection_names_map.insert(std::make_pair(collection_descriptor.first, collection_descriptor.second.as<const std::string&>()));
+		} catch (...) {
+			throw configuration_exception{ "invalid storage configuration" };
+		}
+	}
+}
+
+void storage::fill_entity_read_settings_map(storage_snapshot& snapshot, const steeljson::object& read_preference_descriptors) const {
+	for (const steeljson::object::value_type& read_preference_descriptor : read_preference_descriptors) {
+		if (snapshot.entity_types_map.count(read_preference_descriptor.first) == 0) {
+			throw configuration_exception{ "unknown entity type" };
+		}
+
+		steeljson::object read_preference_descriptor_object;
+		try {
+			read_preference_descriptor_object = read_preference_descriptor.second.as<const steeljson::object&>();
+		} catch (...) {
+			throw configuration_exception{ "invalid storage configuration" };
+		}
+		snapshot.entity_read_settings_map.insert(std::make_pair(
+			read_preference_descriptor.first,
+			this->create_read_settings(read_preference_descriptor_object)
+		));
+	}
+}
+
+void storage::fill_entity_compression_map(storage_snapshot& snapshot, const steeljson::object& compression_descriptors) const {
+	for (const steeljson::object::value_type& compression_descriptor : compression_descriptors) {
+		if (snapshot.entity_types_map.count(compression_descriptor.first) == 0) {
+			throw configuration_exception{ "unknown entity type" };
+		}
+		// data indexes can not see inside compressed documents
+		if (!snapshot.entity_types_map.at(compression_descriptor.first).indexes.empty()) {
+			throw configuration_exception{ "entity types with indexes can not be compressed" };
+		}
+
+		compression_settings settings;
+		std::int64_t threshold{ static_cast<std::int64_t>(settings.threshold) };
+		try {
+			const steeljson::object& descriptor{ compression_descriptor.second.as<const steeljson::object&>() };
+			settings.codec = steelbox::compression_codec_from_name(descriptor.at("codec").as<const std::string&>());
+			if (descriptor.find("threshold") != descriptor.end()) {
+				threshold = descriptor.at("threshold").as<std::int64_t>();
+			}
+			if (descriptor.find("level") != descriptor.end()) {
+				settings.level = static_cast<int>(descriptor.at("level").as<std::int64_t>());
+			}
+		} catch (...) {
+			throw configuration_exception{ "invalid compression configuration" };
+		}
+		// the lz4 acceleration runs the other way than a level, so lz4 takes none
+		if (settings.codec == steelbox::compression_codec::lz4 && settings.level != 0) {
+			throw configuration_exception{ "lz4 compression has no level" };
+		}
+		if (!steelbox::is_compression_codec_available(settings.codec)) {
+			throw configuration_exception{ steelbox::compression_codec_name(settings.codec) + " compression is not built in" };
+		}
+		if (threshold < 0) {
+			throw configuration_exception{ "compression threshold must not be negative" };
+		}
+		settings.threshold = static_cast<std::size_t>(threshold);
+
+		snapshot.entity_compression_map.insert(std::make_pair(compression_descriptor.first, settings));
+	}
+}
+
+void storage::read_negative_lookup_settings(const steeljson::object& negative_lookup_descriptor) {
+	try {
+		if (negative_lookup_descriptor.find("false_positive_rate") != negative_lookup_descriptor.end()) {
+			this->negative_lookup.false_positive_rate = negative_lookup_descriptor.at("false_positive_rate").as<double>();
+		}
+		if (negative_lookup_descriptor.find("capacity_factor") != negative_lookup_descriptor.end()) {
+			this->negative_lookup.capacity_factor = negative_lookup_descriptor.at("capacity_factor").as<double>();
+		}
+		if (negative_lookup_descriptor.find("refresh_interval") != negative_lookup_descriptor.end()) {
+			this->negative_lookup.refresh_interval = std::chrono::seconds{ negative_lookup_descriptor.at("refresh_interval").as<std::int64_t>() };
+		}
+	} catch (...) {
+		throw configuration_exception{ "invalid negative lookup configuration" };
+	}
+
+	if (this->negative_lookup.false_positive_rate <= 0.0 || this->negative_lookup.false_positive_rate >= 1.0) {
+		throw configuration_exception{ "negative lookup false positive rate must be between 0 and 1" };
+	}
+	if (this->negative_lookup.capacity_factor < 1.0) {
+		throw configuration_exception{ "negative lookup capacity factor must be at least 1" };
+	}
+	if (this->negative_lookup.refresh_interval.count() <= 0) {
+		throw configuration_exception{ "negative lookup refresh interval must be positive" };
+	}
+	this->negative_lookup.enabled = true;
+}
+
+read_settings storage::create_read_settings(const steeljson::object& read_preference_descriptor) const {
+	read_settings settings;
+
+	try {
+		if (read_preference_descriptor.find("mode") != read_preference_descriptor.end()) {
+			settings.read_preference.mode(read_mode_from_name(read_preference_descriptor.at("mode").as<const std::string&>()));
+		}
+		if (read_preference_descriptor.find("max_staleness") != read_preference_descriptor.end()) {
+			settings.read_preference.max_staleness(std::chrono::seconds{
+				read_preference_descriptor.at("max_staleness").as<std::int64_t>()
+			});
+		}
+		if (read_preference_descriptor.find("read_concern") != read_preference_descriptor.end()) {
+			mongocxx::read_concern read_concern;
+			read_concern.acknowledge_level(read_concern_level_from_name(read_preference_descriptor.at("read_concern").as<const std::string&>()));
+			settings.read_concern = read_concern;
+		}
+		if (read_preference_descriptor.find("hedge") != read_preference_descriptor.end()) {
+			const steeljson::object& hedge_descriptor{ read_preference_descriptor.at("hedge").as<const steeljson::object&>() };
+
+			settings.hedged = true;
+			settings.hedge_delay = std::chrono::milliseconds{ hedge_descriptor.at("delay").as<std::int64_t>() };
+			// by default the hedged find goes to a member the first one could not have been sent to
+			if (hedge_descriptor.find("mode") != hedge_descriptor.end()) {
+				settings.hedge_read_preference.mode(read_mode_from_name(hedge_descriptor.at("mode").as<const std::string&>()));
+			} else if (settings.read_preference.mode() == mongocxx::read_preference::read_mode::k_primary) {
+				settings.hedge_read_preference.mode(mongocxx::read_preference::read_mode::k_secondary_preferred);
+			}
+		}
+	} catch (const configuration_exception&) {
+		throw;
+	} catch (...) {
+		throw configuration_exception{ "invalid read preference configuration" };
+	}
+
+	if (settings.read_preference.max_staleness() && settings.read_preference.mode() == mongocxx::read_preference::read_mode::k_primary) {
+		throw configuration_exception{ "max staleness can not be used with primary read preference" };
+	}
+	// the driver refuses every read with a smaller max staleness
+	if (settings.read_preference.max_staleness() && *settings.read_preference.max_staleness() < minimum_max_staleness) {
+		throw configuration_exception{ "max staleness must be at least 90 seconds" };
+	}
+	if (settings.hedged && settings.hedge_delay.count() <= 0) {
+		throw configuration_exception{ "hedge delay must be positive" };
+	}
+
+	return settings;
+}
+
+const read_settings& storage::find_read_settings(const storage_snapshot& snapshot, const std::string& entity_type_name) const {
+	const std::unordered_map<std::string, read_settings>::const_iterator settings_it{
+		snapshot.entity_read_settings_map.find(entity_type_name)
+	};
+	if (settings_it == snapshot.entity_read_settings_map.cend()) {
+		return this->default_read_settings;
+	}
+
+	return settings_it->second;
+}
+
+mongocxx::write_concern storage::create_write_concern(const durability_level& durability) const {
+	mongocxx::write_concern write_concern;
+
+	switch (durability) {
+		case durability_level::inherited: {
+			// left at the default level, find_write_concern then takes the collection's
+			break;
+		}
+		case durability_level::unacknowledged: {
+			write_concern.acknowledge_level(mongocxx::write_concern::level::k_unacknowledged);
+			break;
+		}
+		case durability_level::acknowledged: {
+			write_concern.nodes(1);
+			break;
+		}
+		case durability_level::majority: {
+			write_concern.acknowledge_level(mongocxx::write_concern::level::k_majority);
+			break;
+		}
+		case durability_level::journaled: {
+			write_concern.acknowledge_level(mongocxx::write_concern::level::k_majority);
+			write_concern.journal(true);
+			break;
+		}
+	}
+
+	return write_concern;
+}
+
+mongocxx::write_concern storage::find_write_concern(
+	const storage_snapshot& snapshot,
+	const std::string& entity_type_name,
+	const std::chrono::milliseconds& deadline,
+	const mongocxx::write_concern& inherited
+) const {
+	mongocxx::write_concern write_concern{ snapshot.entity_write_concerns_map.at(entity_type_name) };
+	if (write_concern.acknowledge_level() == mongocxx::write_concern::level::k_default) {
+		write_concern = inherited;
+	}
+	// only bounds the wait for replication, the driver has no per-operation timeout for writes,
+	// a write concern left to the server has no level a timeout could be attached to
+	if (deadline.count() > 0 && write_concern.acknowledge_level() != mongocxx::write_concern::level::k_default) {
+		write_concern.timeout(deadline);
+	}
+
+	return write_concern;
+}
+
+std::chrono::milliseconds storage::find_deadline(const storage_snapshot& snapshot, const storage_operation& operation) const {
+	const operation_deadlines::const_iterator deadline_it{ snapshot.deadlines.find(operation) };
+
+	return deadline_it != snapshot.deadlines.cend() ? deadline_it->second : std::chrono::milliseconds{ 0 };
+}
+
+void storage::create_users_collection() {
+	mongocxx::pool::entry client{ this->pool->acquire() };
+	mongocxx::database database{ (*client)[this->db_name] };
+
+	if (!database.has_collection(users_collection_name)) {
+		try {
+			database.create_collection(users_collection_name);
+		} catch (const mongocxx::operation_exception& e) {
+			// another node starting at the same time may have created it
+			if (e.code().value() != namespace_exists_error_code) {
+				throw operation_exception{ std::string("failed to create collection ") + users_collection_name };
+			}
+		}
+	}
+}
+
+void storage::create_entity_collections(const storage_snapshot& snapshot, const std::vector<std::string>& entity_type_names) {
+	// every entity type is provisioned on its own connection so that their
+	// collection and index round trips overlap instead of adding up
+	std::vector<std::future<void>> provisioning;
+	for (const std::string& entity_type_name : entity_type_names) {
+		provisioning.push_back(std::async(std::launch::async, [this, &snapshot, entity_type_name]() {
+			mongocxx::pool::entry client{ this->pool->acquire() };
+			mongocxx::database database{ (*client)[this->db_name] };
+			this->create_entity_collection(database, snapshot, entity_type_name);
+		}));
+	}
+
+	for (std::future<void>& provisioned : provisioning) {
+		provisioned.get();
+	}
+}
+
+void storage::create_entity_collection(mongocxx::database& database, const storage_snapshot& snapshot, const std::string& entity_type_name) {
+	const std::string& collection_name{ snapshot.entity_collection_names_map.at(entity_type_name) };
+	const entity_type_descriptor& descriptor{ snapshot.entity_types_map.at(entity_type_name) };
+
+	if (!database.has_collection(collection_name)) {
+		try {
+			database.create_collection(collection_name);
+		} catch (const mongocxx::operation_exception& e) {
+			// entity types sharing the collection are provisioned concurrently
+			if (e.code().value() != namespace_exists_error_code) {
+				throw operation_exception{ "failed to create collection with the given name" };
+			}
+		}
+	}
+
+	// serves single entity lookups as well as prefix listings ordered by key
+	document_builder key_index;
+	key_index.append(kvp("user_id", 1));
+	for (const entity_attribute_descriptor& attribute_descriptor : descriptor.key) {
+		key_index.append(kvp(entity_type_name + "_id." + attribute_descriptor.name, 1));
+	}
+	document_builder key_index_options;
+	key_index_options.append(kvp("name", key_index_name(entity_type_name, descriptor)));
+
+	try {
+		database[collection_name].create_index(key_index.extract(), key_index_options.extract());
+	} catch (const mongocxx::operation_exception&) {
+		throw operation_exception{ "failed to create key index" };
+	}
+
+	for (const entity_index_descriptor& index_descriptor : descriptor.indexes) {
+		const std::string field_name{ data_field_name(index_descriptor.path) };
+		const std::string index_name{ data_index_name(entity_type_name, index_descriptor.path) };
+
+		document_builder data_index;
+		data_index.append(kvp("user_id", 1));
+		data_index.append(kvp(field_name, 1));
+		// only entities of this type are indexed, so a unique path does not reject
+		// equal values of other types sharing the collection, the queries of this type
+		// filter on the same key field and can still use the index
+		document_builder has_key;
+		has_key.append(kvp("$exists", true));
+		document_builder partial_filter;
+		partial_filter.append(kvp(entity_type_name + "_id", has_key.extract()));
+		document_builder data_index_options;
+		data_index_options.append(kvp("name", index_name));
+		if (index_descriptor.unique) {
+			// entities without the field must not collide on a missing value
+			document_builder exists;
+			exists.append(kvp("$exists", true));
+			partial_filter.append(kvp(field_name, exists.extract()));
+			data_index_options.append(kvp("unique", true));
+		}
+		data_index_options.append(kvp("partialFilterExpression", partial_filter.extract()));
+
+		try {
+			database[collection_name].create_index(data_index.extract(), data_index_options.extract());
+		} catch (const mongocxx::operation_exception&) {
+			throw operation_exception{ "failed to create data index " + index_name };
+		}
+	}
+
+	if (descriptor.time_to_live.count() > 0) {
+		// MongoDB removes expired documents about once a minute
+		document_builder ttl_index;
+		ttl_index.append(kvp(written_at_field_name, 1));
+		document_builder ttl_index_options;
+		ttl_index_options.append(kvp("name", time_to_live_index_name));
+		ttl_index_options.append(kvp("expireAfterSeconds", static_cast<std::int64_t>(descriptor.time_to_live.count())));
+
+		try {
+			database[collection_name].create_index(ttl_index.extract(), ttl_index_options.extract());
+		} catch (const mongocxx::operation_exception&) {
+			// the index exists with the time to live of an earlier configuration
+			document_builder index;
+			index.append(kvp("name", time_to_live_index_name));
+			index.append(kvp("expireAfterSeconds", static_cast<std::int64_t>(descriptor.time_to_live.count())));
+			document_builder command;
+			command.append(kvp("collMod", collection_name));
+			command.append(kvp("index", index.extract()));
+
+			try {
+				database.run_command(command.extract());
+			} catch (const mongocxx::operation_exception&) {
+				throw operation_exception{ "failed to create time to live index" };
+			}
+		}
+	} else {
+		// the time to live of an earlier configuration must not keep expiring entities
+		try {
+			database[collection_name].indexes().drop_one(time_to_live_index_name);
+		} catch (const mongocxx::operation_exception& e) {
+			if (e.code().value() != index_not_found_error_code) {
+				throw operation_exception{ "failed to drop time to live index" };
+			}
+		}
+	}
+
+	if (descriptor.max_entities_per_user > 0) {
+		// finds the least recently written entities of a user when trimming
+		document_builder written_at_index;
+		written_at_index.append(kvp("user_id", 1));
+		written_at_index.append(kvp(written_at_field_name, -1));
+		document_builder written_at_index_options;
+		written_at_index_options.append(kvp("name", written_at_index_name));
+
+		try {
+			database[collection_name].create_index(written_at_index.extract(), written_at_index_options.extract());
+		} catch (const mongocxx::operation_exception&) {
+			throw operation_exception{ "failed to create written at index" };
+		}
+	}
+}
+
+bool storage::find_user_name_by_user_id(const mongocxx::database& database, const bsoncxx::oid& id, std::string& name) const {
+	mongocxx::collection users{ database[users_collection_name] };
+	document_builder filter;
+	filter.append(kvp("_id", id));
+	document_builder projection;
+	projection.append(kvp("user_name", 1));
+	mongocxx::options::find opts;
+	opts.projection(projection.extract());
+
+	const bsoncxx::stdx::optional<bsoncxx::document::value> result = users.find_one(filter.view(), opts);
+	if (!result || !(*result).view()["user_name"] || (*result).view()["user_name"].type() != bsoncxx::type::k_utf8) {
+		return false;
+	}
+
+	name = (*result).view()["user_name"].get_utf8().value.to_string();
+	return true;
+}
+
+bool storage::find_user_id_by_user_name(
+	const std::string& name,
+	const mongocxx::database& database,
+	const read_settings& settings,
+	const std::chrono::milliseconds& deadline,
+	bsoncxx::oid& id
+) const {
+	mongocxx::collection users{ database[users_collection_name] };
+	users.read_preference(settings.read_preference);
+	if (settings.read_concern) {
+		users.read_concern(*settings.read_concern);
+	}
 	document_builder filter;
 
 	filter.append(kvp("user_name", name));
-	const bsoncxx::stdx::optional<bsoncxx::document::value> result = users.find_one(filter.view());
+	mongocxx::options::find opts;
+	if (deadline.count() > 0) {
+		opts.max_time(deadline);
+	}
+	const bsoncxx::stdx::optional<bsoncxx::document::value> result = users.find_one(filter.view(), opts);
 	if (!result) {
 		return false;
 	}
@@ -250,6 +1614,98 @@ bool storage::find_user_id_by_user_name(
 	return true;
 }
 
+std::vector<bsoncxx::document::value> storage::hedged_find(
+	const std::string& collection_name,
+	const bsoncxx::document::value& filter,
+	const read_settings& settings,
+	const operation_budget& budget
+) const {
+	struct hedge_state {
+		hedge_state() :
+			pending(0),
+			done(false) { }
+
+		std::mutex mutex;
+		std::condition_variable answered;
+		std::size_t pending;
+		bool done;
+		std::vector<bsoncxx::document::value> result;
+		std::exception_ptr error;
+	};
+
+	// the slower attempt is abandoned to its pool thread, hence
+	// everything the attempts touch is owned by the attempts themselves
+	const std::shared_ptr<hedge_state> state{ std::make_shared<hedge_state>() };
+	const std::shared_ptr<const bsoncxx::document::value> shared_filter{ std::make_shared<const bsoncxx::document::value>(filter) };
+	const std::shared_ptr<mongocxx::pool> pool{ this->pool };
+	const std::string db_name{ this->db_name };
+	const bsoncxx::stdx::optional<mongocxx::read_concern> read_concern{ settings.read_concern };
+	thread_pool* const attempts{ this->hedged_reads.get() };
+
+	// false when every hedging thread is busy
+	const auto launch_attempt = [=](const mongocxx::read_preference& read_preference) {
+		{
+			std::lock_guard<std::mutex> lock{ state->mutex };
+			++state->pending;
+		}
+
+		const bool launched{ attempts->try_submit([=]() {
+			std::vector<bsoncxx::document::value> documents;
+			std::exception_ptr error;
+
+			try {
+				documents = find_documents(*pool, db_name, collection_name, shared_filter->view(), read_preference, read_concern, budget);
+			} catch (...) {
+				error = std::current_exception();
+			}
+
+			std::lock_guard<std::mutex> lock{ state->mutex };
+			--state->pending;
+			if (state->done) {
+				return;
+			}
+			if (!error) {
+				state->result = std::move(documents);
+				state->done = true;
+			} else if (state->pending == 0) {
+				state->error = error;
+				state->done = true;
+			}
+			state->answered.notify_all();
+		}) };
+
+		if (!launched) {
+			std::lock_guard<std::mutex> lock{ state->mutex };
+			--state->pending;
+		}
+		return launched;
+	};
+
+	// under load the read goes out unhedged rather than waiting for a thread
+	if (!launch_attempt(settings.read_preference)) {
+		return find_documents(*pool, db_name, collection_name, filter.view(), settings.read_preference, read_concern, budget);
+	}
+
+	std::unique_lock<std::mutex> lock{ state->mutex };
+	if (!state->answered.wait_for(lock, settings.hedge_delay, [&state]() { return state->done; })) {
+		lock.unlock();
+		launch_attempt(settings.hedge_read_preference);
+		lock.lock();
+		// the attempts end on their own once maxTimeMS passes, the caller does not wait for that
+		if (!budget.is_limited()) {
+			state->answered.wait(lock, [&state]() { return state->done; });
+		} else if (!state->answered.wait_for(lock, budget.remaining(), [&state]() { return state->done; })) {
+			throw operation_exception{ "operation deadline exceeded" };
+		}
+	}
+
+	if (state->error) {
+		std::rethrow_exception(state->error);
+	}
+
+	return std::move(state->result);
+}
+
 std::vector<entity_attribute_descriptor>::const_iterator storage::find_entity_attribute_descriptor_by_attribute_name(
 	const std::string& name,
 	const std::vector<entity_attribute_descriptor>& descriptors
@@ -265,38 +1721,589 @@ std::vector<entity_attribute_descriptor>::const_iterator storage::find_entity_at
 	return ci;
 }
 
-document_builder storage::create_key_document(
-	const std::string& entity_type_name,
+void storage::append_key_attribute(
+	document_builder& builder,
+	const std::string& field_name,
+	const entity_attribute_descriptor& attribute_descriptor,
+	const boost::any& value
+) const {
+	switch (attribute_descriptor.type) {
+		case entity_attribute_type::integer: {
+			builder.append(kvp(field_name, boost::any_cast<std::int64_t>(value)));
+			break;
+		}
+		case entity_attribute_type::floating_point: {
+			builder.append(kvp(field_name, boost::any_cast<float>(value)));
+			break;
+		}
+		case entity_attribute_type::string: {
+			builder.append(kvp(field_name, boost::any_cast<std::string>(value)));
+			break;
+		}
+	}
+}
+
+void storage::append_key_after(
+	document_builder& filter,
+	const std::string& key_field_name,
+	const std::vector<entity_attribute_descriptor>& key_descriptor,
+	std::size_t prefix_size,
+	const std::vector<boost::any>& after
+) const {
+	if (after.empty()) {
+		return;
+	}
+
+	// keyset condition: (r0 > a0) or (r0 = a0 and r1 > a1) or ...
+	bsoncxx::builder::basic::array alternatives;
+	for (std::size_t i = 0; i < after.size(); ++i) {
+		document_builder alternative;
+		for (std::size_t j = 0; j <= i; ++j) {
+			const entity_attribute_descriptor& attribute_descriptor{ key_descriptor[prefix_size + j] };
+			const std::string field_name{ key_field_name + "." + attribute_descriptor.name };
+
+			if (j < i) {
+				this->append_key_attribute(alternative, field_name, attribute_descriptor, after[j]);
+			} else {
+				document_builder greater_than;
+				this->append_key_attribute(greater_than, "$gt", attribute_descriptor, after[j]);
+				alternative.append(kvp(field_name, greater_than.extract()));
+			}
+		}
+		alternatives.append(alternative.extract());
+	}
+	filter.append(kvp("$or", alternatives.extract()));
+}
+
+void storage::append_entity_type_condition(document_builder& filter, const std::string& entity_type_name) const {
+	// entities of other types sharing the collection have no key of this type
+	document_builder exists;
+	exists.append(kvp("$exists", true));
+	filter.append(kvp(entity_type_name + "_id", exists.extract()));
+}
+
+std::string storage::create_key_identity(
+	const entity_type_descriptor& descriptor,
 	const std::unordered_map<std::string, const boost::any>& entity_key
 ) const {
-	document_builder key_document;
-	const entity_type_descriptor& descriptor{ this->entity_types_map.at(entity_type_name) };
+	return descriptor.key_identity(entity_key);
+}
 
-	for (std::size_t i = 0; i < descriptor.key.size(); ++i) {
-		const entity_attribute_descriptor& key_attribute_descriptor{ descriptor.key[i] };
-		if (entity_key.count(key_attribute_descriptor.name) == 0) {
-			throw std::invalid_argument{ "invalid entity key" };
+std::string storage::create_key_identity(
+	const entity_type_descriptor& descriptor,
+	const bsoncxx::document::view& key_document
+) const {
+	std::string identity;
+
+	for (const entity_attribute_descriptor& attribute_descriptor : descriptor.key) {
+		const bsoncxx::document::element attribute{ key_document[attribute_descriptor.name] };
+		if (!attribute) {
+			throw data_exception{ "entity key must contain all key attributes" };
 		}
 
-		const boost::any& key_attribute_value{ entity_key.at(key_attribute_descriptor.name) };
-		switch (key_attribute_descriptor.type) {
-			case entity_attribute_type::integer:
-			{
-				key_document.append(kvp(key_attribute_descriptor.name, boost::any_cast<std::int64_t>(key_attribute_value)));
+		switch (attribute_descriptor.type) {
+			case entity_attribute_type::integer: {
+				if (attribute.type() == bsoncxx::type::k_int32) {
+					identity += std::to_string(attribute.get_int32().value);
+				} else {
+					identity += std::to_string(attribute.get_int64().value);
+				}
 				break;
 			}
-			case entity_attribute_type::floating_point:
-			{
-				key_document.append(kvp(key_attribute_descriptor.name, boost::any_cast<float>(key_attribute_value)));
+			case entity_attribute_type::floating_point: {
+				const double floating_point_value{ attribute.get_double().value };
+				char bytes[sizeof(double)];
+				std::memcpy(bytes, &floating_point_value, sizeof(double));
+				identity.append(bytes, sizeof(double));
 				break;
 			}
-			case entity_attribute_type::string:
-			{
-				key_document.append(kvp(key_attribute_descriptor.name, boost::any_cast<std::string>(key_attribute_value)));
+			case entity_attribute_type::string: {
+				const bsoncxx::stdx::string_view string_value{ attribute.get_utf8().value };
+				identity += std::to_string(string_value.size());
+				identity += ':';
+				identity.append(string_value.data(), string_value.size());
 				break;
 			}
 		}
+		identity += '/';
+	}
+
+	return identity;
+}
+
+bsoncxx::document::value storage::create_entity_filter(
+	const storage_snapshot& snapshot,
+	const bsoncxx::oid& user_id,
+	const std::string& entity_type_name,
+	const std::unordered_map<std::string, const boost::any>& entity_key
+) const {
+	const entity_type_descriptor& descriptor{ snapshot.entity_types_map.at(entity_type_name) };
+	document_builder filter;
+	filter.append(kvp("user_id", user_id));
+	// dotted equalities match the key index, an upsert still creates the nested key document
+	for (const entity_attribute_descriptor& attribute_descriptor : descriptor.key) {
+		if (entity_key.count(attribute_descriptor.name) == 0) {
+			throw std::invalid_argument{ "invalid entity key" };
+		}
+		this->append_key_attribute(filter, entity_type_name + "_id." + attribute_descriptor.name, attribute_descriptor, entity_key.at(attribute_descriptor.name));
+	}
+
+	return filter.extract();
+}
+
+std::vector<std::size_t> storage::find_failed_writes(const mongocxx::bulk_write_exception& e) const {
+	if (!e.raw_server_error()) {
+		throw operation_exception{ "bulk insert operation failed" };
+	}
+	const bsoncxx::document::view server_error{ e.raw_server_error()->view() };
+
+	// without an acknowledged write concern no write is known to be durable
+	const bsoncxx::document::element write_concern_errors{ server_error["writeConcernErrors"] };
+	if (write_concern_errors && (write_concern_errors.type() != bsoncxx::type::k_array || !write_concern_errors.get_array().value.empty())) {
+		throw operation_exception{ "bulk insert operation failed" };
+	}
+
+	const bsoncxx::document::element write_errors{ server_error["writeErrors"] };
+	if (!write_errors || write_errors.type() != bsoncxx::type::k_array || write_errors.get_array().value.empty()) {
+		throw operation_exception{ "bulk insert operation failed" };
+	}
+
+	std::vector<std::size_t> failed_indexes;
+	for (const bsoncxx::array::element& write_error : write_errors.get_array().value) {
+		const bsoncxx::document::element index{ write_error["index"] };
+		if (!index || index.type() != bsoncxx::type::k_int32 || index.get_int32().value < 0) {
+			throw operation_exception{ "bulk insert operation failed" };
+		}
+		failed_indexes.push_back(static_cast<std::size_t>(index.get_int32().value));
+	}
+
+	return failed_indexes;
+}
+
+bsoncxx::document::value storage::create_entity_update(const storage_snapshot& snapshot, const std::string& entity_type_name, const steeljson::value& data) const {
+	document_builder set_params;
+	bool compressed{ false };
+
+	const std::unordered_map<std::string, compression_settings>::const_iterator compression_it{
+		snapshot.entity_compression_map.find(entity_type_name)
+	};
+	if (compression_it != snapshot.entity_compression_map.cend()) {
+		// the data is compressed as a {data: ...} document so that any JSON value round-trips
+		document_builder wrapper;
+		append_json_to_document(wrapper, "data", data);
+		const bsoncxx::document::value wrapped_data{ wrapper.extract() };
+		const bsoncxx::document::view wrapped_view{ wrapped_data.view() };
+
+		if (wrapped_view.length() > compression_it->second.threshold) {
+			const std::vector<std::uint8_t> block{
+				steelbox::compress(compression_it->second.codec, wrapped_view.data(), wrapped_view.length(), compression_it->second.level)
+			};
+			// incompressible data stays native
+			if (block.size() < wrapped_view.length()) {
+				bsoncxx::types::b_binary binary_data;
+				binary_data.sub_type = bsoncxx::binary_sub_type::k_binary;
+				binary_data.size = static_cast<std::uint32_t>(block.size());
+				binary_data.bytes = block.data();
+				set_params.append(kvp("data", binary_data));
+				set_params.append(kvp(data_codec_field_name, steelbox::compression_codec_name(compression_it->second.codec)));
+				compressed = true;
+			}
+		}
+	}
+
+	document_builder update_document;
+	if (compressed) {
+		update_document.append(kvp("$set", set_params));
+	} else {
+		append_json_to_document(set_params, "data", data);
+		update_document.append(kvp("$set", set_params));
+		document_builder unset_params;
+		unset_params.append(kvp(data_codec_field_name, ""));
+		update_document.append(kvp("$unset", unset_params));
+	}
+	// taken from the server clock so that nodes with skewed clocks agree on the age of entities
+	document_builder current_date_params;
+	current_date_params.append(kvp(written_at_field_name, true));
+	update_document.append(kvp("$currentDate", current_date_params));
+
+	return update_document.extract();
+}
+
+steeljson::value storage::read_entity_data(const bsoncxx::document::view& entity_data) const {
+	const bsoncxx::document::element data{ entity_data["data"] };
+	const bsoncxx::document::element codec_name{ entity_data[data_codec_field_name] };
+	if (!codec_name) {
+		return build_json(data.get_value());
+	}
+
+	if (data.type() != bsoncxx::type::k_binary || codec_name.type() != bsoncxx::type::k_utf8) {
+		throw data_exception{ "compressed entity data must be binary with a codec name" };
+	}
+
+	steelbox::compression_codec codec;
+	try {
+		codec = steelbox::compression_codec_from_name(codec_name.get_utf8().value.to_string());
+	} catch (const std::invalid_argument&) {
+		throw data_exception{ "unknown entity data codec" };
+	}
+
+	const bsoncxx::types::b_binary binary_data{ data.get_binary() };
+	std::vector<std::uint8_t> wrapped_data;
+	try {
+		wrapped_data = steelbox::decompress(codec, binary_data.bytes, binary_data.size);
+	} catch (const steelbox::compression_exception&) {
+		throw data_exception{ "compressed entity data is corrupt" };
+	}
+
+	const bsoncxx::stdx::optional<bsoncxx::document::view> wrapped_view{ bsoncxx::validate(wrapped_data.data(), wrapped_data.size()) };
+	if (!wrapped_view || !(*wrapped_view)["data"]) {
+		throw data_exception{ "compressed entity data is not a data document" };
+	}
+
+	return build_json((*wrapped_view)["data"].get_value());
+}
+
+void storage::rebuild_known_entities() {
+	std::lock_guard<std::mutex> rebuild_lock{ this->known_entities_rebuild_mutex };
+	{
+		std::lock_guard<std::mutex> lock{ this->known_entities_mutex };
+		this->rebuilding_known_entities = true;
+		this->known_entities_log.clear();
+	}
+
+	std::shared_ptr<known_entity_filters> filters;
+	try {
+		filters = this->build_known_entities();
+	} catch (...) {
+		std::lock_guard<std::mutex> lock{ this->known_entities_mutex };
+		this->rebuilding_known_entities = false;
+		this->known_entities_log.clear();
+		throw;
+	}
+
+	std::lock_guard<std::mutex> lock{ this->known_entities_mutex };
+	for (const std::pair<std::string, std::string>& logged_entity : this->known_entities_log) {
+		if (logged_entity.first.empty()) {
+			filters->users->insert(logged_entity.second);
+		} else if (filters->entities.count(logged_entity.first) != 0) {
+			filters->entities.at(logged_entity.first)->insert(logged_entity.second);
+		}
+	}
+	this->known_entities_log.clear();
+	this->rebuilding_known_entities = false;
+	std::atomic_store(&this->known_entities, std::shared_ptr<const known_entity_filters>{ filters });
+}
+
+std::shared_ptr<known_entity_filters> storage::build_known_entities() const {
+	const std::shared_ptr<const storage_snapshot> snapshot{ std::atomic_load(&this->snapshot) };
+	std::shared_ptr<known_entity_filters> filters{ std::make_shared<known_entity_filters>() };
+	mongocxx::pool::entry client{ this->pool->acquire() };
+	const mongocxx::database database{ (*client)[this->db_name] };
+
+	// entity documents refer to users by id while lookups come by name
+	std::unordered_map<std::string, std::string> user_names;
+	{
+		mongocxx::collection users{ database[users_collection_name] };
+		const std::int64_t user_count{ users.count(document_builder{}.extract()) };
+		filters->users.reset(new bloom_filter{
+			static_cast<std::size_t>(static_cast<double>(user_count) * this->negative_lookup.capacity_factor) + negative_lookup_minimum_capacity,
+			this->negative_lookup.false_positive_rate
+		});
+
+		document_builder projection;
+		projection.append(kvp("user_name", 1));
+		mongocxx::options::find opts;
+		opts.projection(projection.extract());
+
+		mongocxx::cursor users_data = users.find(document_builder{}.extract(), opts);
+		for (const bsoncxx::document::view& user : users_data) {
+			if (!user["user_name"] || user["user_name"].type() != bsoncxx::type::k_utf8) {
+				continue;
+			}
+
+			const std::string user_name{ user["user_name"].get_utf8().value.to_string() };
+			filters->users->insert(user_name);
+			user_names.insert(std::make_pair(user["_id"].get_oid().value.to_string(), user_name));
+		}
+	}
+
+	for (const std::unordered_map<std::string, std::string>::value_type& collection : snapshot->entity_collection_names_map) {
+		const entity_type_descriptor& descriptor{ snapshot->entity_types_map.at(collection.first) };
+		const std::string key_field_name{ collection.first + "_id" };
+		mongocxx::collection entities{ database[collection.second] };
+
+		const std::int64_t entity_count{ entities.count(document_builder{}.extract()) };
+		std::unique_ptr<bloom_filter> entity_filter{ new bloom_filter{
+			static_cast<std::size_t>(static_cast<double>(entity_count) * this->negative_lookup.capacity_factor) + negative_lookup_minimum_capacity,
+			this->negative_lookup.false_positive_rate
+		} };
+
+		document_builder projection;
+		projection.append(kvp("_id", 0));
+		projection.append(kvp("user_id", 1));
+		projection.append(kvp(key_field_name, 1));
+		mongocxx::options::find opts;
+		opts.projection(projection.extract());
+		opts.batch_size(snapshot->export_batch_size);
+
+		mongocxx::cursor entities_data = entities.find(document_builder{}.extract(), opts);
+		for (const bsoncxx::document::view& entity_data : entities_data) {
+			if (!entity_data["user_id"] || !entity_data[key_field_name]) {
+				continue;
+			}
+
+			const std::unordered_map<std::string, std::string>::const_iterator user_name_it{
+				user_names.find(entity_data["user_id"].get_oid().value.to_string())
+			};
+			if (user_name_it == user_names.cend()) {
+				continue;
+			}
+
+			entity_filter->insert(user_name_it->second + '\0' + this->create_key_identity(descriptor, entity_data[key_field_name].get_document().value));
+		}
+
+		filters->entities.insert(std::make_pair(collection.first, std::move(entity_filter)));
+		filters->collection_names.insert(collection);
+	}
+
+	return filters;
+}
+
+std::vector<std::string> storage::watched_collection_names(const storage_snapshot& snapshot) const {
+	std::unordered_set<std::string> collection_names{ users_collection_name };
+	for (const std::unordered_map<std::string, std::string>::value_type& collection : snapshot.entity_collection_names_map) {
+		collection_names.insert(collection.second);
+	}
+
+	return std::vector<std::string>{ collection_names.cbegin(), collection_names.cend() };
+}
+
+void storage::apply_change(const bsoncxx::document::view& change) {
+	const std::string collection_name{ change["ns"].get_document().value["coll"].get_utf8().value.to_string() };
+	const bsoncxx::document::view document{ change["fullDocument"].get_document().value };
+
+	if (collection_name == users_collection_name) {
+		if (!document["user_name"] || document["user_name"].type() != bsoncxx::type::k_utf8) {
+			return;
+		}
+
+		const std::string user_name{ document["user_name"].get_utf8().value.to_string() };
+		if (this->changed_user_names.size() >= changed_user_names_capacity) {
+			this->changed_user_names.clear();
+		}
+		this->changed_user_names[document["_id"].get_oid().value.to_string()] = user_name;
+		this->remember_user(user_name);
+		return;
+	}
+
+	if (!document["user_id"] || document["user_id"].type() != bsoncxx::type::k_oid) {
+		return;
+	}
+
+	// entity documents refer to users by id while the filters hold names
+	const std::shared_ptr<const storage_snapshot> snapshot{ std::atomic_load(&this->snapshot) };
+	const bsoncxx::oid user_id{ document["user_id"].get_oid().value };
+	std::string user_name;
+	bool user_name_found{ false };
+	for (const std::unordered_map<std::string, std::string>::value_type& collection : snapshot->entity_collection_names_map) {
+		const std::string key_field_name{ collection.first + "_id" };
+		if (collection.second != collection_name || !document[key_field_name]) {
+			continue;
+		}
+
+		if (!user_name_found) {
+			const std::unordered_map<std::string, std::string>::const_iterator user_name_it{ this->changed_user_names.find(user_id.to_string()) };
+			if (user_name_it != this->changed_user_names.cend()) {
+				user_name = user_name_it->second;
+			} else {
+				mongocxx::pool::entry client{ this->pool->acquire() };
+				const mongocxx::database database{ (*client)[this->db_name] };
+				if (!this->find_user_name_by_user_id(database, user_id, user_name)) {
+					return;
+				}
+				if (this->changed_user_names.size() >= changed_user_names_capacity) {
+					this->changed_user_names.clear();
+				}
+				this->changed_user_names[user_id.to_string()] = user_name;
+			}
+			user_name_found = true;
+		}
+
+		const entity_type_descriptor& descriptor{ snapshot->entity_types_map.at(collection.first) };
+		this->remember_entity(*snapshot, user_name, collection.first, this->create_key_identity(descriptor, document[key_field_name].get_document().value));
+	}
+}
+
+bool storage::is_known_user(const std::string& username) const {
+	const std::shared_ptr<const known_entity_filters> filters{ std::atomic_load(&this->known_entities) };
+
+	return !filters || filters->users->might_contain(username);
+}
+
+bool storage::is_known_entity(
+	const storage_snapshot& snapshot,
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::string& key_identity
+) const {
+	const std::shared_ptr<const known_entity_filters> filters{ std::atomic_load(&this->known_entities) };
+	if (!filters) {
+		return true;
+	}
+
+	const bloom_filter* const entity_filter{ find_entity_filter(*filters, snapshot, entity_type_name) };
+	return entity_filter == nullptr || entity_filter->might_contain(username + '\0' + key_identity);
+}
+
+void storage::remember_user(const std::string& username) {
+	std::lock_guard<std::mutex> lock{ this->known_entities_mutex };
+	const std::shared_ptr<const known_entity_filters> filters{ std::atomic_load(&this->known_entities) };
+	if (filters) {
+		filters->users->insert(username);
+	}
+	if (this->rebuilding_known_entities) {
+		this->known_entities_log.push_back(std::make_pair(std::string{ }, username));
+	}
+}
+
+void storage::remember_entity(
+	const storage_snapshot& snapshot,
+	const std::string& username,
+	const std::string& entity_type_name,
+	const std::string& key_identity
+) {
+	const std::string entity{ username + '\0' + key_identity };
+
+	// the lock keeps a put from landing in filters that are being replaced without being logged
+	std::lock_guard<std::mutex> lock{ this->known_entities_mutex };
+	const std::shared_ptr<const known_entity_filters> filters{ std::atomic_load(&this->known_entities) };
+	if (filters) {
+		filters->users->insert(username);
+		bloom_filter* const entity_filter{ find_entity_filter(*filters, snapshot, entity_type_name) };
+		if (entity_filter != nullptr) {
+			entity_filter->insert(entity);
+		}
+	}
+	if (this->rebuilding_known_entities) {
+		this->known_entities_log.push_back(std::make_pair(std::string{ }, username));
+		this->known_entities_log.push_back(std::make_pair(entity_type_name, entity));
+	}
+}
+
+void storage::remember_untrimmed_user(const storage_snapshot& snapshot, const std::string& entity_type_name, const bsoncxx::oid& user_id) {
+	if (snapshot.entity_types_map.at(entity_type_name).max_entities_per_user == 0) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock{ this->untrimmed_users_mutex };
+	this->untrimmed_users[entity_type_name].insert(user_id.to_string());
+}
+
+void storage::trim_entities() {
+	// only users put to since the last trim can have gone over the limit,
+	// users not put to again after a restart are trimmed on their next put
+	std::unordered_map<std::string, std::unordered_set<std::string>> users;
+	{
+		std::lock_guard<std::mutex> lock{ this->untrimmed_users_mutex };
+		users.swap(this->untrimmed_users);
+	}
+	if (users.empty()) {
+		return;
+	}
+
+	const std::shared_ptr<const storage_snapshot> snapshot{ std::atomic_load(&this->snapshot) };
+	mongocxx::pool::entry client{ this->pool->acquire() };
+	const mongocxx::database database{ (*client)[this->db_name] };
+
+	for (const std::unordered_map<std::string, std::unordered_set<std::string>>::value_type& entity_type_users : users) {
+		// the limit may have been removed since the users were put to
+		const std::unordered_map<std::string, entity_type_descriptor>::const_iterator entity_type_it{
+			snapshot->entity_types_map.find(entity_type_users.first)
+		};
+		if (entity_type_it == snapshot->entity_types_map.cend() || entity_type_it->second.max_entities_per_user == 0) {
+			continue;
+		}
+
+		for (const std::string& user_id : entity_type_users.second) {
+			try {
+				this->trim_user_entities(database, *snapshot, entity_type_users.first, bsoncxx::oid{ user_id });
+			} catch (const mongocxx::exception&) {
+				std::lock_guard<std::mutex> lock{ this->untrimmed_users_mutex };
+				this->untrimmed_users[entity_type_users.first].insert(user_id);
+			}
+		}
 	}
+}
+
+void storage::trim_user_entities(
+	const mongocxx::database& database,
+	const storage_snapshot& snapshot,
+	const std::string& entity_type_name,
+	const bsoncxx::oid& user_id
+) const {
+	const std::size_t max_entities{ snapshot.entity_types_map.at(entity_type_name).max_entities_per_user };
+	mongocxx::collection entities{ database[snapshot.entity_collection_names_map.at(entity_type_name)] };
+
+	document_builder filter;
+	filter.append(kvp("user_id", user_id));
+	this->append_entity_type_condition(filter, entity_type_name);
+	document_builder sort;
+	sort.append(kvp(written_at_field_name, -1));
+	document_builder projection;
+	projection.append(kvp("_id", 1));
+	projection.append(kvp(written_at_field_name, 1));
+	mongocxx::options::find opts;
+	opts.sort(sort.extract());
+	opts.skip(static_cast<std::int32_t>(max_entities));
+	opts.projection(projection.extract());
+	opts.batch_size(snapshot.export_batch_size);
+
+	mongocxx::options::delete_options delete_opts;
+	delete_opts.write_concern(this->find_write_concern(snapshot, entity_type_name, std::chrono::milliseconds{ 0 }, entities.write_concern()));
+
+	bool found{ false };
+	bsoncxx::stdx::optional<bsoncxx::types::b_date> newest_trimmed;
+	// entities put again since they were found are newer than the newest trimmed one and stay
+	const auto delete_trimmed = [&](bsoncxx::builder::basic::array& trimmed_ids) {
+		document_builder id_condition;
+		id_condition.append(kvp("$in", trimmed_ids.extract()));
+		document_builder delete_filter;
+		delete_filter.append(kvp("user_id", user_id));
+		this->append_entity_type_condition(delete_filter, entity_type_name);
+		delete_filter.append(kvp("_id", id_condition.extract()));
+		if (newest_trimmed) {
+			document_builder newer;
+			newer.append(kvp("$gt", *newest_trimmed));
+			document_builder not_newer;
+			not_newer.append(kvp("$not", newer.extract()));
+			delete_filter.append(kvp(written_at_field_name, not_newer.extract()));
+		} else {
+			document_builder exists;
+			exists.append(kvp("$exists", false));
+			delete_filter.append(kvp(written_at_field_name, exists.extract()));
+		}
+
+		entities.delete_many(delete_filter.view(), delete_opts);
+	};
 
-	return key_document;
+	// ids are deleted a batch at a time so that the filter of a user far above
+	// the limit stays within the BSON size limit and memory stays bounded
+	bsoncxx::builder::basic::array trimmed_ids;
+	std::int32_t batched_ids{ 0 };
+	mongocxx::cursor entities_data = entities.find(filter.view(), opts);
+	for (const bsoncxx::document::view& entity_data : entities_data) {
+		if (!found && entity_data[written_at_field_name] && entity_data[written_at_field_name].type() == bsoncxx::type::k_date) {
+			newest_trimmed = entity_data[written_at_field_name].get_date();
+		}
+		found = true;
+		trimmed_ids.append(entity_data["_id"].get_value());
+		if (++batched_ids == snapshot.export_batch_size) {
+			delete_trimmed(trimmed_ids);
+			trimmed_ids = bsoncxx::builder::basic::array{ };
+			batched_ids = 0;
+		}
+	}
+	if (batched_ids > 0) {
+		delete_trimmed(trimmed_ids);
+	}
 }
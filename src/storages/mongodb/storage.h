@@ -1,14 +1,32 @@
 #ifndef STEELBOX_MONGODB_STORAGE_H
 #define STEELBOX_MONGODB_STORAGE_H
 
+#include "../../bloom_filter.h"
+#include "../../compression.h"
 #include "../../entity_type.h"
+#include "../../periodic_task.h"
+#include "../../thread_pool.h"
 #include "../storage.h"
+#include "../storage_operation.h"
+#include "change_stream_watcher.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 #include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/stdx/optional.hpp>
 #include <bsoncxx/types.hpp>
 #include <mongocxx/client.hpp>
+#include <mongocxx/exception/bulk_write_exception.hpp>
 #include <mongocxx/instance.hpp>
+#include <mongocxx/pool.hpp>
+#include <mongocxx/read_concern.hpp>
+#include <mongocxx/read_preference.hpp>
+#include <mongocxx/write_concern.hpp>
 #include <steeljson/value.h>
 
 namespace steelbox {
@@ -17,6 +35,104 @@ namespace mongodb {
 
 	const std::string storage_type = "mongodb";
 	const std::string users_collection_name = "users";
+	const std::int32_t default_export_batch_size = 1000;
+	const std::size_t negative_lookup_minimum_capacity = 1024;
+	const int duplicate_key_error_code = 11000;
+	const int namespace_exists_error_code = 48;
+	const int index_not_found_error_code = 27;
+	const std::size_t default_compression_threshold = 16 * 1024;
+	// set on documents whose data is a compressed binary, holds the codec name
+	const std::string data_codec_field_name = "data_codec";
+	// server time of the last put of an entity, used to expire and trim entities
+	const std::string written_at_field_name = "written_at";
+	const std::string time_to_live_index_name = "written_at_ttl";
+	const std::string written_at_index_name = "user_id_written_at";
+	const std::chrono::seconds default_trim_interval{ 10 };
+	// threads running the attempts of hedged reads, a read finding none idle is not hedged
+	const std::int64_t default_hedged_read_threads = 16;
+	const std::chrono::seconds minimum_max_staleness{ 90 };
+	const std::chrono::milliseconds default_change_stream_retry_interval{ 1000 };
+	// user names of entities changed on other nodes kept before the cache is cleared
+	const std::size_t changed_user_names_capacity = 100000;
+	// longest pause between two tries to take a connection from an exhausted pool
+	const std::chrono::milliseconds max_acquire_retry_interval{ 16 };
+	// added to the longest deadline for the socket timeout, covers the wait of change stream batches
+	const std::chrono::milliseconds socket_timeout_margin{ 2000 };
+
+	struct read_settings {
+		read_settings();
+
+		mongocxx::read_preference read_preference;
+		bsoncxx::stdx::optional<mongocxx::read_concern> read_concern;
+		// when set, a second find is sent with hedge_read_preference
+		// if the first one has not answered within hedge_delay
+		bool hedged;
+		std::chrono::milliseconds hedge_delay;
+		mongocxx::read_preference hedge_read_preference;
+	};
+
+	struct compression_settings {
+		compression_settings();
+
+		compression_codec codec;
+		// data whose BSON size is at most this many bytes stays native
+		std::size_t threshold;
+		int level;
+	};
+
+	struct negative_lookup_settings {
+		negative_lookup_settings();
+
+		bool enabled;
+		double false_positive_rate;
+		// filters are sized for this many times the entities found when they are built
+		double capacity_factor;
+		std::chrono::seconds refresh_interval;
+	};
+
+	// users and (user, key) pairs that existed when the filters were built or were put since,
+	// a lookup missing from them can be answered without querying MongoDB
+	struct known_entity_filters {
+		std::unique_ptr<bloom_filter> users;
+		std::unordered_map<std::string, std::unique_ptr<bloom_filter>> entities;
+		// collections the entity filters were built from, a filter does not
+		// cover an entity type mapped to another collection since
+		std::unordered_map<std::string, std::string> collection_names;
+	};
+
+	// the time left of an operation, shared by all of its round trips so that
+	// the connection, the user lookup and the find together stay within the deadline
+	class operation_budget {
+		public:
+			// a zero deadline never runs out
+			explicit operation_budget(const std::chrono::milliseconds& deadline);
+
+			bool is_limited() const;
+			// zero without a deadline, throws operation_exception once the deadline has passed
+			std::chrono::milliseconds remaining() const;
+			// the driver waits for a free connection without a timeout, hence the pool is polled
+			mongocxx::pool::entry acquire(mongocxx::pool& pool) const;
+
+		private:
+			bool limited;
+			std::chrono::steady_clock::time_point expiry;
+	};
+
+	// the part of the configuration that can be replaced while the storage is in use,
+	// an operation keeps the snapshot it started with until it finishes
+	struct storage_snapshot {
+		storage_snapshot();
+
+		std::unordered_map<std::string, entity_type_descriptor> entity_types_map;
+		std::unordered_map<std::string, std::string> entity_collection_names_map;
+		std::unordered_map<std::string, read_settings> entity_read_settings_map;
+		std::unordered_map<std::string, mongocxx::write_concern> entity_write_concerns_map;
+		std::unordered_map<std::string, compression_settings> entity_compression_map;
+		std::int32_t export_batch_size;
+		// bound the whole operation, what is left of them is applied as maxTimeMS
+		// to reads and as the write concern timeout to writes
+		operation_deadlines deadlines;
+	};
 
 	class storage : public steelbox::storages::storage {
 		public:
@@ -27,7 +143,7 @@ namespace mongodb {
 			storage(const storage&) = delete;
 			//storage(storage&& other);
 
-			~storage() = default;
+			~storage();
 
 			storage operator=(const storage&) = delete;
 			// TODO: use std::any (c++17)
@@ -36,12 +152,53 @@ namespace mongodb {
 				const std::string& entity_type_name,
 				const std::unordered_map<std::string, const boost::any>& entity_filter
 			);
+			virtual std::vector<boost::optional<steeljson::value>> get_many(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::vector<std::unordered_map<std::string, const boost::any>>& entity_keys
+			);
 			virtual void put(
 				const std::string& username,
 				const std::string& entity_type_name,
 				const std::unordered_map<std::string, const boost::any>& entity_key,
 				const steeljson::value& data
 			);
+			virtual std::vector<entity> list(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::unordered_map<std::string, const boost::any>& key_prefix,
+				const std::vector<boost::any>& after,
+				std::size_t limit
+			);
+			virtual std::vector<entity> query(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::vector<data_predicate>& predicates,
+				std::size_t limit
+			);
+			virtual void put_many(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::vector<std::pair<std::unordered_map<std::string, const boost::any>, steeljson::value>>& entities
+			);
+			virtual void export_entities(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::string& after_entity_type_name,
+				const std::vector<boost::any>& after,
+				std::size_t limit,
+				const entity_consumer& consumer
+			);
+			// replaces the entity types and the settings of the storage configuration, creating
+			// the collections and indexes of new or changed entity types before they are used,
+			// the type and uri must not change and the negative lookup settings are kept
+			void reconfigure(
+				const steeljson::object& storage_config,
+				const std::unordered_map<std::string, entity_type_descriptor>& entity_types_map
+			);
+			// opens this many pooled connections at once and looks up the users on them,
+			// so that the first requests find neither cold connections nor cold user lookups
+			void warm_up(std::size_t connections, const std::vector<std::string>& usernames);
 			/*virtual void patch(
 				const std::string& username,
 				const std::string& entity_type_name,
@@ -51,29 +208,121 @@ namespace mongodb {
 
 		private:
 			bool database_exists(const std::string&) const;
-			void fill_entity_collection_names_map(const steeljson::object&);
+			std::shared_ptr<const storage_snapshot> create_snapshot(
+				const steeljson::object&,
+				const std::unordered_map<std::string, entity_type_descriptor>&
+			) const;
+			void fill_entity_collection_names_map(storage_snapshot&, const steeljson::object&) const;
+			void fill_entity_read_settings_map(storage_snapshot&, const steeljson::object&) const;
+			void fill_entity_compression_map(storage_snapshot&, const steeljson::object&) const;
+			void read_negative_lookup_settings(const steeljson::object&);
+			read_settings create_read_settings(const steeljson::object&) const;
+			const read_settings& find_read_settings(const storage_snapshot&, const std::string&) const;
+			mongocxx::write_concern create_write_concern(const durability_level&) const;
+			// a write concern inherited from the uri or the server is taken from the collection written to
+			mongocxx::write_concern find_write_concern(
+				const storage_snapshot&,
+				const std::string&,
+				const std::chrono::milliseconds&,
+				const mongocxx::write_concern&
+			) const;
+			// zero when the operation has no deadline
+			std::chrono::milliseconds find_deadline(const storage_snapshot&, const storage_operation&) const;
 			void create_users_collection();
-			void create_entity_collections();
+			void create_entity_collections(const storage_snapshot&, const std::vector<std::string>&);
+			void create_entity_collection(mongocxx::database&, const storage_snapshot&, const std::string&);
+			bool find_user_name_by_user_id(const mongocxx::database&, const bsoncxx::oid&, std::string&) const;
 			bool find_user_id_by_user_name(
 				const std::string&,
 				const mongocxx::database&,
+				const read_settings&,
+				const std::chrono::milliseconds&,
 				bsoncxx::oid&
 			) const; // TODO: use std::optional (c++17)
+			std::vector<bsoncxx::document::value> hedged_find(
+				const std::string&,
+				const bsoncxx::document::value&,
+				const read_settings&,
+				const operation_budget&
+			) const;
 			std::vector<entity_attribute_descriptor>::const_iterator find_entity_attribute_descriptor_by_attribute_name(
 				const std::string&,
 				const std::vector<entity_attribute_descriptor>&
 			) const;
-			bsoncxx::builder::basic::document create_key_document(
+			void append_key_attribute(
+				bsoncxx::builder::basic::document&,
+				const std::string&,
+				const entity_attribute_descriptor&,
+				const boost::any&
+			) const;
+			// appends the condition selecting keys ordered after the given values of the key attributes following prefix_size
+			void append_key_after(
+				bsoncxx::builder::basic::document&,
+				const std::string&,
+				const std::vector<entity_attribute_descriptor>&,
+				std::size_t,
+				const std::vector<boost::any>&
+			) const;
+			// appends the condition excluding entities of other types sharing the collection
+			void append_entity_type_condition(bsoncxx::builder::basic::document&, const std::string&) const;
+			std::string create_key_identity(
+				const entity_type_descriptor&,
+				const std::unordered_map<std::string, const boost::any>&
+			) const;
+			std::string create_key_identity(
+				const entity_type_descriptor&,
+				const bsoncxx::document::view&
+			) const;
+			bsoncxx::document::value create_entity_filter(
+				const storage_snapshot&,
+				const bsoncxx::oid&,
 				const std::string&,
 				const std::unordered_map<std::string, const boost::any>&
 			) const;
+			// positions of the rejected writes of an unordered bulk write whose other writes were applied
+			std::vector<std::size_t> find_failed_writes(const mongocxx::bulk_write_exception&) const;
+			bsoncxx::document::value create_entity_update(const storage_snapshot&, const std::string&, const steeljson::value&) const;
+			steeljson::value read_entity_data(const bsoncxx::document::view&) const;
+			void rebuild_known_entities();
+			std::shared_ptr<known_entity_filters> build_known_entities() const;
+			std::vector<std::string> watched_collection_names(const storage_snapshot&) const;
+			void apply_change(const bsoncxx::document::view&);
+			bool is_known_user(const std::string&) const;
+			bool is_known_entity(const storage_snapshot&, const std::string&, const std::string&, const std::string&) const;
+			void remember_user(const std::string&);
+			void remember_entity(const storage_snapshot&, const std::string&, const std::string&, const std::string&);
+			void remember_untrimmed_user(const storage_snapshot&, const std::string&, const bsoncxx::oid&);
+			void trim_entities();
+			void trim_user_entities(const mongocxx::database&, const storage_snapshot&, const std::string&, const bsoncxx::oid&) const;
 
 		private:
 			mongocxx::instance instance;
-			mongocxx::client client;
+			std::shared_ptr<mongocxx::pool> pool;
+			std::string uri;
 			std::string db_name;
-			std::unordered_map<std::string, std::string> entity_collection_names_map;
-			std::unordered_map<std::string, entity_type_descriptor> entity_types_map;
+			read_settings default_read_settings;
+			// read with std::atomic_load, replaced under reconfigure_mutex
+			std::shared_ptr<const storage_snapshot> snapshot;
+			std::mutex reconfigure_mutex;
+			negative_lookup_settings negative_lookup;
+			std::shared_ptr<const known_entity_filters> known_entities;
+			// held for a whole rebuild, the refresh and a change stream reset may both start one
+			std::mutex known_entities_rebuild_mutex;
+			std::mutex known_entities_mutex;
+			bool rebuilding_known_entities;
+			// entities put while the filters are rebuilt, an empty entity type name stands for a user
+			std::vector<std::pair<std::string, std::string>> known_entities_log;
+			std::chrono::seconds trim_interval;
+			std::mutex untrimmed_users_mutex;
+			// ids of users, by entity type, put to since the last trim of a type with a maximum number of entities
+			std::unordered_map<std::string, std::unordered_set<std::string>> untrimmed_users;
+			// names of users by id hex string, only used by the change stream thread
+			std::unordered_map<std::string, std::string> changed_user_names;
+			std::unique_ptr<thread_pool> hedged_reads;
+			// declared last so they are stopped before anything they use is destroyed
+			std::unique_ptr<periodic_task> known_entities_refresh;
+			std::unique_ptr<periodic_task> trimming;
+			std::unique_ptr<change_stream_watcher> change_watcher;
 	};
 
 }
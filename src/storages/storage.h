@@ -1,16 +1,41 @@
 #ifndef STEELBOX_STORAGE_H
 #define STEELBOX_STORAGE_H
 
+#include <functional>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include <boost/any.hpp>
+#include <boost/optional.hpp>
 #include <steeljson/value.h>
 //#include <steeljson/patch.h>
 
 namespace steelbox {
 namespace storages {
 
+	struct entity {
+		steeljson::value key;
+		steeljson::value data;
+	};
+
+	enum class comparison_operator {
+		equal,
+		greater,
+		greater_or_equal,
+		less,
+		less_or_equal
+	};
+
+	// condition on an indexed path inside the entity data, value has the type of the index
+	struct data_predicate {
+		std::string path;
+		comparison_operator comparison;
+		boost::any value;
+	};
+
+	// receives the entity type name, key and data of every exported entity
+	using entity_consumer = std::function<void(const std::string&, const steeljson::value&, const steeljson::value&)>;
+
 	class storage {
 		public:
 			virtual std::vector<steeljson::value> get(
@@ -18,12 +43,51 @@ namespace storages {
 				const std::string& entity_type_name,
 				const std::unordered_map<std::string, const boost::any>& entity_filter
 			) = 0;
+			// returns the data of every requested entity in the order of entity_keys, none for missing ones
+			virtual std::vector<boost::optional<steeljson::value>> get_many(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::vector<std::unordered_map<std::string, const boost::any>>& entity_keys
+			) = 0;
 			virtual void put(
 				const std::string& username,
 				const std::string& entity_type_name,
 				const std::unordered_map<std::string, const boost::any>& entity_key,
 				const steeljson::value& data
 			) = 0;
+			// returns up to limit entities whose leading key attributes equal key_prefix, ordered by
+			// the remaining key attributes and starting after the remaining attribute values in after
+			virtual std::vector<entity> list(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::unordered_map<std::string, const boost::any>& key_prefix,
+				const std::vector<boost::any>& after,
+				std::size_t limit
+			) = 0;
+			// returns up to limit entities matching all predicates, every predicate path must be indexed
+			virtual std::vector<entity> query(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::vector<data_predicate>& predicates,
+				std::size_t limit
+			) = 0;
+			// upserts all given entities of one type in a single round trip
+			virtual void put_many(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::vector<std::pair<std::unordered_map<std::string, const boost::any>, steeljson::value>>& entities
+			) = 0;
+			// passes up to limit entities ordered by entity type name and key to consumer, starting
+			// after the entity of type after_entity_type_name whose key values are after,
+			// entities of every type are exported when entity_type_name is empty
+			virtual void export_entities(
+				const std::string& username,
+				const std::string& entity_type_name,
+				const std::string& after_entity_type_name,
+				const std::vector<boost::any>& after,
+				std::size_t limit,
+				const entity_consumer& consumer
+			) = 0;
 			/*virtual void patch(
 				const std::string& username,
 				const std::string& entity_type_name,
@@ -0,0 +1,82 @@
+#include "storage_operation.h"
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include "../exception.h"
+
+using namespace steelbox::storages;
+
+namespace {
+
+	const std::vector<std::pair<storage_operation, std::string>>& storage_operation_names() {
+		static const std::vector<std::pair<storage_operation, std::string>> names{
+			{ storage_operation::get, "get" },
+			{ storage_operation::get_many, "get_many" },
+			{ storage_operation::put, "put" },
+			{ storage_operation::put_many, "put_many" },
+			{ storage_operation::list, "list" },
+			{ storage_operation::query, "query" },
+			{ storage_operation::export_entities, "export" }
+		};
+
+		return names;
+	}
+
+}
+
+const std::vector<storage_operation>& steelbox::storages::storage_operations() {
+	static const std::vector<storage_operation> operations{ []() {
+		std::vector<storage_operation> operations;
+		for (const std::pair<storage_operation, std::string>& name : storage_operation_names()) {
+			operations.push_back(name.first);
+		}
+
+		return operations;
+	}() };
+
+	return operations;
+}
+
+const std::string& steelbox::storages::storage_operation_name(const storage_operation& operation) {
+	for (const std::pair<storage_operation, std::string>& name : storage_operation_names()) {
+		if (name.first == operation) {
+			return name.second;
+		}
+	}
+
+	throw std::invalid_argument{ "unknown storage operation" };
+}
+
+operation_deadlines steelbox::storages::read_operation_deadlines(const steeljson::object& storage_config) {
+	operation_deadlines deadlines;
+	if (storage_config.find("deadlines") == storage_config.end()) {
+		return deadlines;
+	}
+
+	try {
+		for (const steeljson::object::value_type& deadline : storage_config.at("deadlines").as<const steeljson::object&>()) {
+			bool known_operation{ false };
+			for (const std::pair<storage_operation, std::string>& name : storage_operation_names()) {
+				if (name.second == deadline.first) {
+					deadlines[name.first] = std::chrono::milliseconds{ deadline.second.as<std::int64_t>() };
+					known_operation = true;
+				}
+			}
+			if (!known_operation) {
+				throw configuration_exception{ "unknown storage operation " + deadline.first };
+			}
+		}
+	} catch (const configuration_exception&) {
+		throw;
+	} catch (...) {
+		throw configuration_exception{ "invalid storage deadlines" };
+	}
+
+	for (const operation_deadlines::value_type& deadline : deadlines) {
+		if (deadline.second.count() <= 0) {
+			throw configuration_exception{ "storage deadlines must be positive" };
+		}
+	}
+
+	return deadlines;
+}
@@ -0,0 +1,35 @@
+#ifndef STEELBOX_STORAGE_OPERATION_H
+#define STEELBOX_STORAGE_OPERATION_H
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <steeljson/value.h>
+
+namespace steelbox {
+namespace storages {
+
+	enum class storage_operation {
+		get,
+		get_many,
+		put,
+		put_many,
+		list,
+		query,
+		export_entities
+	};
+
+	using operation_deadlines = std::map<storage_operation, std::chrono::milliseconds>;
+
+	const std::vector<storage_operation>& storage_operations();
+	// name used for the operation in the configuration and in statistics
+	const std::string& storage_operation_name(const storage_operation& operation);
+	// reads the optional "deadlines" object of a storage configuration,
+	// mapping operation names to milliseconds, operations without one are left out
+	operation_deadlines read_operation_deadlines(const steeljson::object& storage_config);
+
+}
+}
+
+#endif // STEELBOX_STORAGE_OPERATION_H
@@ -0,0 +1,150 @@
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <steeljson/reader.h>
+#include <steeljson/value.h>
+#include <steeljson/writer.h>
+#include "../json_writer.h"
+
+// compares write_json with steeljson::write, the escaping of both may differ,
+// so the output of write_json is read back and written again by steeljson
+
+namespace {
+
+	std::size_t failures{ 0 };
+
+	std::string write_with_steeljson(const steeljson::value& value) {
+		std::ostringstream stream;
+		steeljson::write(stream, value);
+
+		return stream.str();
+	}
+
+	void check_value(const steeljson::value& value) {
+		std::ostringstream written;
+		steelbox::write_json(written, value);
+
+		const std::string expected{ write_with_steeljson(value) };
+		std::string actual;
+		try {
+			std::istringstream written_stream{ written.str() };
+			actual = write_with_steeljson(steeljson::read_document(written_stream));
+		} catch (...) {
+			actual = "unreadable: " + written.str();
+		}
+
+		if (actual != expected && ++failures <= 20) {
+			std::cerr << "write_json differs from steeljson::write" << std::endl
+				<< "  expected: " << expected << std::endl
+				<< "  actual:   " << actual << std::endl;
+		}
+	}
+
+	void check_edge_cases() {
+		check_value(steeljson::null);
+		check_value(steeljson::value{ true });
+		check_value(steeljson::value{ false });
+		check_value(steeljson::value{ static_cast<std::int64_t>(0) });
+		check_value(steeljson::value{ static_cast<std::int64_t>(-9007199254740991) });
+		check_value(steeljson::value{ 0.5 });
+		check_value(steeljson::value{ std::string{ } });
+		check_value(steeljson::value{ std::string{ "\"\\/\b\f\n\r\t" } });
+		check_value(steeljson::value{ std::string{ "Gr\xC3\xBC\xC3\x9F" "e \xE6\x9D\xB1\xE4\xBA\xAC \xF0\x9F\x9A\x80" } });
+		check_value(steeljson::value{ std::string(100, '"') });
+		check_value(steeljson::value{ std::string(100, 'a') + "\\" });
+
+		// every control character alone and at the block boundaries of the vectorized scan
+		for (int c = 0; c < 0x20; ++c) {
+			check_value(steeljson::value{ std::string(1, static_cast<char>(c)) });
+			for (std::size_t offset : { 15, 16, 31, 32, 33 }) {
+				check_value(steeljson::value{ std::string(offset, 'x') + static_cast<char>(c) + std::string(offset, 'y') });
+			}
+		}
+
+		check_value(steeljson::array{ });
+		check_value(steeljson::object{ });
+		steeljson::object nested;
+		nested.insert(steeljson::object::value_type{ "key \"quoted\"\n", steeljson::array{ steeljson::null, steeljson::value{ true } } });
+		nested.insert(steeljson::object::value_type{ "", steeljson::object{ } });
+		check_value(steeljson::array{ steeljson::value{ nested }, steeljson::value{ std::string{ "\x01" } } });
+	}
+
+	steeljson::value random_value(std::mt19937& random, int depth) {
+		static const char alphabet[] = "ab \"\\/\b\f\n\r\t\x01\x1F\x7F" "\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80";
+		std::uniform_int_distribution<int> kind{ 0, depth > 3 ? 3 : 5 };
+		std::uniform_int_distribution<int> size{ 0, 40 };
+		std::uniform_int_distribution<std::size_t> letter{ 0, sizeof(alphabet) - 2 };
+
+		const auto random_string = [&]() {
+			// multi-byte characters are taken whole from the alphabet so that the text stays valid UTF-8
+			std::string str;
+			const int characters{ size(random) };
+			for (int i = 0; i < characters; ++i) {
+				const std::size_t position{ letter(random) };
+				const unsigned char lead{ static_cast<unsigned char>(alphabet[position]) };
+				if (lead < 0x80) {
+					str += static_cast<char>(lead);
+				} else if (lead >= 0xC0) {
+					const std::size_t length{ lead >= 0xF0 ? 4u : lead >= 0xE0 ? 3u : 2u };
+					str.append(alphabet + position, length);
+				}
+			}
+			return str;
+		};
+
+		switch (kind(random)) {
+			case 0: {
+				return steeljson::null;
+			}
+			case 1: {
+				return steeljson::value{ random() % 2 == 0 };
+			}
+			case 2: {
+				return steeljson::value{ static_cast<std::int64_t>(random()) - static_cast<std::int64_t>(random()) };
+			}
+			case 3: {
+				return steeljson::value{ random_string() };
+			}
+			case 4: {
+				steeljson::array array;
+				const int elements{ size(random) / 8 };
+				for (int i = 0; i < elements; ++i) {
+					array.push_back(random_value(random, depth + 1));
+				}
+				return array;
+			}
+			default: {
+				steeljson::object object;
+				const int members{ size(random) / 8 };
+				for (int i = 0; i < members; ++i) {
+					object.insert(steeljson::object::value_type{ random_string(), random_value(random, depth + 1) });
+				}
+				return object;
+			}
+		}
+	}
+
+	void check_random_values() {
+		std::mt19937 random{ 32 };
+
+		for (int round = 0; round < 20000; ++round) {
+			check_value(random_value(random, 0));
+		}
+	}
+
+}
+
+int main() {
+	check_edge_cases();
+	check_random_values();
+
+	if (failures > 0) {
+		std::cerr << failures << " checks failed" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,198 @@
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../utf8.h"
+
+// compares the vectorized scans with the scalar ones on edge cases and random input
+
+namespace {
+
+	std::size_t failures{ 0 };
+
+	std::string describe(const std::string& data) {
+		static const char hex_digits[] = "0123456789abcdef";
+		std::string description;
+
+		for (const char c : data) {
+			const unsigned char byte{ static_cast<unsigned char>(c) };
+			description += hex_digits[byte >> 4];
+			description += hex_digits[byte & 0x0F];
+			description += ' ';
+		}
+
+		return description;
+	}
+
+	void expect(bool condition, const std::string& what, const std::string& data) {
+		if (!condition) {
+			if (++failures <= 20) {
+				std::cerr << what << ": " << describe(data) << std::endl;
+			}
+		}
+	}
+
+	void check_scans(const std::string& data) {
+		expect(
+			steelbox::is_valid_utf8(data.data(), data.size()) == steelbox::is_valid_utf8_scalar(data.data(), data.size()),
+			"is_valid_utf8 differs from is_valid_utf8_scalar",
+			data
+		);
+		expect(
+			steelbox::find_json_escape(data.data(), data.size()) == steelbox::find_json_escape_scalar(data.data(), data.size()),
+			"find_json_escape differs from find_json_escape_scalar",
+			data
+		);
+	}
+
+	// the sequence at offsets around the 16 and 32 byte blocks of the vectorized scans
+	void check_placed(const std::string& sequence) {
+		static const std::size_t offsets[] = { 0, 1, 13, 15, 16, 29, 30, 31, 32, 63 };
+
+		for (const std::size_t offset : offsets) {
+			std::string data(offset, 'a');
+			data += sequence;
+			check_scans(data);
+			data += std::string(40, 'b');
+			check_scans(data);
+		}
+	}
+
+	void check_expected(const std::string& data, bool valid) {
+		expect(steelbox::is_valid_utf8_scalar(data.data(), data.size()) == valid, "unexpected is_valid_utf8_scalar result", data);
+		check_placed(data);
+	}
+
+	void check_known_sequences() {
+		check_expected("", true);
+		check_expected("plain ascii", true);
+		check_expected("\xC2\x80", true);
+		check_expected("\xDF\xBF", true);
+		check_expected("\xE0\xA0\x80", true);
+		check_expected("\xED\x9F\xBF", true);
+		check_expected("\xEF\xBF\xBF", true);
+		check_expected("\xF0\x90\x80\x80", true);
+		check_expected("\xF4\x8F\xBF\xBF", true);
+		check_expected("\xC0\x80", false); // overlong
+		check_expected("\xC1\xBF", false); // overlong
+		check_expected("\xE0\x9F\xBF", false); // overlong
+		check_expected("\xED\xA0\x80", false); // surrogate
+		check_expected("\xF0\x8F\xBF\xBF", false); // overlong
+		check_expected("\xF4\x90\x80\x80", false); // above U+10FFFF
+		check_expected("\xF5\x80\x80\x80", false);
+		check_expected("\xFF", false);
+		check_expected("\x80", false); // lone continuation
+		check_expected("\xC2", false); // truncated
+		check_expected("\xE0\xA0", false);
+		check_expected("\xF0\x90\x80", false);
+		check_expected("\xC2\x80\x80", false); // continuation too many
+		check_expected("\xE0\xA0\x80\x80", false);
+		check_expected("\xF0\x90\x80\x80\x80", false);
+		check_expected("\xC2" "a", false);
+		check_expected("\xE0\xA0" "a", false);
+	}
+
+	void check_all_short_sequences() {
+		for (unsigned first = 0; first < 256; ++first) {
+			for (unsigned second = 0; second < 256; ++second) {
+				check_placed(std::string{ static_cast<char>(first), static_cast<char>(second) });
+			}
+		}
+
+		// every lead byte above ASCII with every second byte and the common third bytes
+		static const unsigned char third_bytes[] = { 0x00, 0x41, 0x7F, 0x80, 0x9F, 0xA0, 0xBF, 0xC0, 0xE0, 0xF0, 0xFF };
+		for (unsigned first = 0x80; first < 256; ++first) {
+			for (unsigned second = 0; second < 256; ++second) {
+				for (const unsigned char third : third_bytes) {
+					const std::string sequence{ static_cast<char>(first), static_cast<char>(second), static_cast<char>(third) };
+					check_scans(sequence);
+					check_scans(std::string(30, 'a') + sequence);
+					check_scans(std::string(31, 'a') + sequence + "\x80\x80");
+				}
+			}
+		}
+	}
+
+	void append_code_point(std::string& data, std::uint32_t code_point) {
+		if (code_point < 0x80) {
+			data += static_cast<char>(code_point);
+		} else if (code_point < 0x800) {
+			data += static_cast<char>(0xC0 | (code_point >> 6));
+			data += static_cast<char>(0x80 | (code_point & 0x3F));
+		} else if (code_point < 0x10000) {
+			data += static_cast<char>(0xE0 | (code_point >> 12));
+			data += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+			data += static_cast<char>(0x80 | (code_point & 0x3F));
+		} else {
+			data += static_cast<char>(0xF0 | (code_point >> 18));
+			data += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+			data += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+			data += static_cast<char>(0x80 | (code_point & 0x3F));
+		}
+	}
+
+	// valid text mixing all sequence lengths, with a byte changed now and then
+	void check_random_text() {
+		std::mt19937 random{ 20161 };
+		std::uniform_int_distribution<std::uint32_t> ascii{ 0, 0x7F };
+		std::uniform_int_distribution<std::uint32_t> code_point{ 0x80, 0x10FFFF };
+		std::uniform_int_distribution<int> length{ 0, 300 };
+		std::uniform_int_distribution<int> choice{ 0, 9 };
+		std::uniform_int_distribution<int> byte{ 0, 255 };
+
+		for (int round = 0; round < 200000; ++round) {
+			std::string data;
+			const int code_points{ length(random) };
+			for (int i = 0; i < code_points; ++i) {
+				std::uint32_t next{ choice(random) < 6 ? ascii(random) : code_point(random) };
+				if (next >= 0xD800 && next <= 0xDFFF) {
+					next = 0xFFFD;
+				}
+				append_code_point(data, next);
+			}
+			expect(steelbox::is_valid_utf8_scalar(data.data(), data.size()), "generated text rejected", data);
+
+			if (!data.empty() && choice(random) < 5) {
+				const int changes{ 1 + choice(random) / 4 };
+				for (int i = 0; i < changes; ++i) {
+					data[static_cast<std::size_t>(random() % data.size())] = static_cast<char>(byte(random));
+				}
+			}
+			if (!data.empty() && choice(random) == 0) {
+				data.resize(static_cast<std::size_t>(random() % data.size()));
+			}
+			check_scans(data);
+		}
+	}
+
+	void check_random_bytes() {
+		std::mt19937 random{ 7 };
+		std::uniform_int_distribution<int> length{ 0, 100 };
+		std::uniform_int_distribution<int> byte{ 0, 255 };
+
+		for (int round = 0; round < 200000; ++round) {
+			std::string data(static_cast<std::size_t>(length(random)), '\0');
+			for (char& c : data) {
+				c = static_cast<char>(byte(random));
+			}
+			check_scans(data);
+		}
+	}
+
+}
+
+int main() {
+	check_known_sequences();
+	check_all_short_sequences();
+	check_random_text();
+	check_random_bytes();
+
+	if (failures > 0) {
+		std::cerr << failures << " checks failed" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,64 @@
+#include "thread_pool.h"
+#include <stdexcept>
+#include <utility>
+
+using namespace steelbox;
+
+thread_pool::thread_pool(std::size_t threads) :
+	idle_threads(0),
+	stopping(false) {
+	if (threads == 0) {
+		throw std::invalid_argument{ "thread count must be positive" };
+	}
+
+	for (std::size_t i = 0; i < threads; ++i) {
+		this->threads.push_back(std::thread{ &thread_pool::run, this });
+	}
+}
+
+thread_pool::~thread_pool() {
+	{
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		this->stopping = true;
+	}
+	this->task_available.notify_all();
+	for (std::thread& thread : this->threads) {
+		thread.join();
+	}
+}
+
+bool thread_pool::try_submit(const std::function<void()>& task) {
+	{
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		// queued tasks are already promised to idle threads
+		if (this->stopping || this->idle_threads <= this->tasks.size()) {
+			return false;
+		}
+		this->tasks.push_back(task);
+	}
+	this->task_available.notify_one();
+
+	return true;
+}
+
+void thread_pool::run() {
+	std::unique_lock<std::mutex> lock{ this->mutex };
+
+	while (true) {
+		++this->idle_threads;
+		this->task_available.wait(lock, [this]() { return this->stopping || !this->tasks.empty(); });
+		--this->idle_threads;
+		if (this->tasks.empty()) {
+			return;
+		}
+
+		const std::function<void()> task{ std::move(this->tasks.front()) };
+		this->tasks.pop_front();
+		lock.unlock();
+		try {
+			task();
+		} catch (...) {
+		}
+		lock.lock();
+	}
+}
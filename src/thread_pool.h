@@ -0,0 +1,43 @@
+#ifndef STEELBOX_THREAD_POOL_H
+#define STEELBOX_THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace steelbox {
+
+	// A fixed number of threads running submitted tasks until destroyed,
+	// the destructor waits for the running tasks.
+	// Exceptions thrown by a task are swallowed.
+	class thread_pool {
+		public:
+			explicit thread_pool(std::size_t threads);
+			thread_pool(const thread_pool&) = delete;
+
+			~thread_pool();
+
+			thread_pool& operator=(const thread_pool&) = delete;
+
+			// starts the task if a thread is idle, returns false without running it otherwise
+			bool try_submit(const std::function<void()>& task);
+
+		private:
+			void run();
+
+		private:
+			std::mutex mutex;
+			std::condition_variable task_available;
+			std::deque<std::function<void()>> tasks;
+			std::size_t idle_threads;
+			bool stopping;
+			std::vector<std::thread> threads;
+	};
+
+}
+
+#endif // STEELBOX_THREAD_POOL_H
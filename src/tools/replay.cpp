@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <istream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include "../exception.h"
+#include "../traffic_log.h"
+
+using namespace steelbox;
+
+namespace {
+
+	struct replay_options {
+		std::string log_path;
+		std::string host{ "127.0.0.1" };
+		std::string port{ "31700" };
+		std::size_t connections{ 8 };
+		// 0 replays as fast as possible, otherwise the original pace is divided by it
+		double speed{ 1.0 };
+	};
+
+	struct replay_result {
+		bool failed;
+		std::uint16_t status;
+		// from sending the request to reading the whole response
+		std::uint64_t service_us;
+		// from the time the request was due, includes waiting for a free connection
+		std::uint64_t latency_us;
+	};
+
+	// body of the original size for requests whose body was not captured
+	std::string build_placeholder_body(std::size_t size) {
+		const std::string prefix{ "{\"replay\":\"" };
+		const std::string suffix{ "\"}" };
+
+		if (size >= prefix.size() + suffix.size()) {
+			return prefix + std::string(size - prefix.size() - suffix.size(), 'x') + suffix;
+		}
+		if (size >= 2) {
+			return "{}" + std::string(size - 2, ' ');
+		}
+
+		return std::string(size, ' ');
+	}
+
+	class http_connection {
+		public:
+			http_connection(const std::string& host, const std::string& port) :
+				host(host),
+				port(port),
+				socket(io_service) {
+			}
+
+			// returns false if the request failed even after reconnecting once
+			bool send(const traffic_record& record, const std::string& body, std::uint16_t& status) {
+				for (int attempt = 0; attempt < 2; ++attempt) {
+					try {
+						if (!this->socket.is_open()) {
+							this->connect();
+						}
+						this->exchange(record, body, status);
+						return true;
+					} catch (const std::exception&) {
+						boost::system::error_code ignored;
+						this->socket.close(ignored);
+					}
+				}
+
+				return false;
+			}
+
+		private:
+			void connect() {
+				boost::asio::ip::tcp::resolver resolver{ this->io_service };
+				boost::asio::connect(this->socket, resolver.resolve(boost::asio::ip::tcp::resolver::query{ this->host, this->port }));
+				this->socket.set_option(boost::asio::ip::tcp::no_delay{ true });
+				this->response_buffer.consume(this->response_buffer.size());
+			}
+
+			void exchange(const traffic_record& record, const std::string& body, std::uint16_t& status) {
+				std::string request{ record.method + " " + record.url + " HTTP/1.1\r\nHost: " + this->host + "\r\n" };
+				request += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+				request += body;
+				boost::asio::write(this->socket, boost::asio::buffer(request));
+
+				const std::size_t header_size{ boost::asio::read_until(this->socket, this->response_buffer, "\r\n\r\n") };
+				std::string header(header_size, '\0');
+				std::istream response_stream{ &this->response_buffer };
+				response_stream.read(&header[0], static_cast<std::streamsize>(header_size));
+
+				// "HTTP/1.1 200 OK"
+				const std::size_t status_position{ header.find(' ') };
+				if (status_position == std::string::npos) {
+					throw std::runtime_error{ "invalid status line" };
+				}
+				status = static_cast<std::uint16_t>(std::stoi(header.substr(status_position + 1, 3)));
+
+				std::string lower_header{ header };
+				std::transform(lower_header.begin(), lower_header.end(), lower_header.begin(), ::tolower);
+				std::size_t content_length{ 0 };
+				const std::size_t content_length_position{ lower_header.find("\r\ncontent-length:") };
+				if (content_length_position != std::string::npos) {
+					content_length = static_cast<std::size_t>(std::stoull(header.substr(content_length_position + 17)));
+				}
+
+				if (this->response_buffer.size() < content_length) {
+					boost::asio::read(this->socket, this->response_buffer, boost::asio::transfer_exactly(content_length - this->response_buffer.size()));
+				}
+				this->response_buffer.consume(content_length);
+
+				if (lower_header.find("\r\nconnection: close") != std::string::npos) {
+					this->socket.close();
+				}
+			}
+
+		private:
+			std::string host;
+			std::string port;
+			boost::asio::io_service io_service;
+			boost::asio::ip::tcp::socket socket;
+			boost::asio::streambuf response_buffer;
+	};
+
+	bool parse_options(int argc, char** argv, replay_options& options) {
+		for (int i = 1; i < argc; ++i) {
+			const std::string argument{ argv[i] };
+			const bool has_value{ i + 1 < argc };
+
+			try {
+				if (argument == "--host" && has_value) {
+					options.host = argv[++i];
+				} else if (argument == "--port" && has_value) {
+					options.port = argv[++i];
+				} else if (argument == "--connections" && has_value) {
+					options.connections = static_cast<std::size_t>(std::stoul(argv[++i]));
+				} else if (argument == "--speed" && has_value) {
+					options.speed = std::stod(argv[++i]);
+				} else if (argument == "--fast") {
+					options.speed = 0.0;
+				} else if (options.log_path.empty() && argument.compare(0, 2, "--") != 0) {
+					options.log_path = argument;
+				} else {
+					return false;
+				}
+			} catch (...) {
+				return false;
+			}
+		}
+
+		return !options.log_path.empty() && options.connections > 0 && options.speed >= 0.0;
+	}
+
+	void print_distribution(const std::string& name, std::vector<std::uint64_t> values) {
+		std::cout << std::left << std::setw(24) << name << std::right << std::setw(10) << values.size();
+		if (values.empty()) {
+			std::cout << std::endl;
+			return;
+		}
+
+		std::sort(values.begin(), values.end());
+		for (double quantile : { 0.5, 0.9, 0.99, 0.999 }) {
+			const std::size_t index{ std::min(values.size() - 1, static_cast<std::size_t>(quantile * values.size())) };
+			std::cout << std::setw(10) << values[index];
+		}
+		std::cout << std::setw(10) << values.back() << std::endl;
+	}
+
+}
+
+int main(int argc, char** argv) {
+	replay_options options;
+	if (!parse_options(argc, argv, options)) {
+		std::cerr << "usage: steelbox_replay <log> [--host host] [--port port] [--connections n] [--speed factor | --fast]" << std::endl;
+		return 1;
+	}
+
+	std::vector<traffic_record> records;
+	try {
+		traffic_log_reader reader{ options.log_path };
+		traffic_record record;
+		while (reader.next(record)) {
+			records.push_back(record);
+		}
+	} catch (const traffic_log_exception& e) {
+		std::cerr << e.message() << std::endl;
+		return 1;
+	}
+
+	// records are logged when requests complete, replay them in arrival order
+	std::stable_sort(records.begin(), records.end(), [](const traffic_record& lhs, const traffic_record& rhs) {
+		return lhs.offset_us < rhs.offset_us;
+	});
+	const std::uint64_t first_offset_us{ records.empty() ? 0 : records.front().offset_us };
+
+	std::vector<replay_result> results(records.size());
+	std::atomic<std::size_t> next_record{ 0 };
+	const std::chrono::steady_clock::time_point replay_start{ std::chrono::steady_clock::now() };
+
+	std::vector<std::thread> workers;
+	for (std::size_t i = 0; i < options.connections; ++i) {
+		workers.emplace_back([&]() {
+			http_connection connection{ options.host, options.port };
+
+			for (std::size_t index = next_record++; index < records.size(); index = next_record++) {
+				const traffic_record& record{ records[index] };
+				std::chrono::steady_clock::time_point due{ std::chrono::steady_clock::now() };
+				if (options.speed > 0.0) {
+					due = replay_start + std::chrono::microseconds{
+						static_cast<std::int64_t>(static_cast<double>(record.offset_us - first_offset_us) / options.speed)
+					};
+					std::this_thread::sleep_until(due);
+				}
+
+				const std::string body{ record.body.size() == record.body_size ? record.body : build_placeholder_body(record.body_size) };
+				const std::chrono::steady_clock::time_point sent{ std::chrono::steady_clock::now() };
+				replay_result& result{ results[index] };
+				result.failed = !connection.send(record, body, result.status);
+				const std::chrono::steady_clock::time_point received{ std::chrono::steady_clock::now() };
+				result.service_us = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(received - sent).count());
+				result.latency_us = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(received - due).count());
+			}
+		});
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	const double elapsed_seconds{ std::chrono::duration<double>(std::chrono::steady_clock::now() - replay_start).count() };
+
+	std::size_t failed{ 0 };
+	std::size_t status_mismatches{ 0 };
+	std::vector<std::uint64_t> captured;
+	std::vector<std::uint64_t> service_times;
+	std::vector<std::uint64_t> latencies;
+	std::map<std::string, std::vector<std::uint64_t>> method_latencies;
+	for (std::size_t i = 0; i < records.size(); ++i) {
+		captured.push_back(records[i].duration_us);
+		if (results[i].failed) {
+			++failed;
+			continue;
+		}
+		if (results[i].status != records[i].status) {
+			++status_mismatches;
+		}
+		service_times.push_back(results[i].service_us);
+		latencies.push_back(results[i].latency_us);
+		method_latencies[records[i].method].push_back(results[i].latency_us);
+	}
+
+	std::cout << "requests: " << records.size()
+		<< ", failed: " << failed
+		<< ", status mismatches: " << status_mismatches
+		<< ", elapsed: " << std::fixed << std::setprecision(3) << elapsed_seconds << " s"
+		<< ", throughput: " << std::setprecision(1) << (elapsed_seconds > 0 ? records.size() / elapsed_seconds : 0.0) << " req/s"
+		<< std::endl << std::endl;
+
+	std::cout << std::left << std::setw(24) << "microseconds" << std::right
+		<< std::setw(10) << "count" << std::setw(10) << "p50" << std::setw(10) << "p90"
+		<< std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(10) << "max" << std::endl;
+	print_distribution("captured", captured);
+	print_distribution("replayed service time", service_times);
+	print_distribution("replayed latency", latencies);
+	for (const std::pair<const std::string, std::vector<std::uint64_t>>& method : method_latencies) {
+		print_distribution("  " + method.first, method.second);
+	}
+
+	return failed == 0 ? 0 : 2;
+}
@@ -0,0 +1,79 @@
+#include "traffic_capture.h"
+#include <algorithm>
+#include <limits>
+#include "exception.h"
+
+using namespace steelbox;
+
+traffic_capture::traffic_capture() :
+	capture_bodies(false),
+	max_body_size(default_capture_max_body_size) {
+}
+
+void traffic_capture::start(const steeljson::object& config) {
+	std::string path;
+	std::int64_t max_body_size{ static_cast<std::int64_t>(default_capture_max_body_size) };
+	std::int64_t buffer_size{ static_cast<std::int64_t>(default_capture_buffer_size) };
+
+	try {
+		path = config.at("path").as<const std::string&>();
+		if (config.find("bodies") != config.end()) {
+			this->capture_bodies = config.at("bodies").as<bool>();
+		}
+		if (config.find("max_body_size") != config.end()) {
+			max_body_size = config.at("max_body_size").as<std::int64_t>();
+		}
+		if (config.find("buffer_size") != config.end()) {
+			buffer_size = config.at("buffer_size").as<std::int64_t>();
+		}
+	} catch (...) {
+		throw configuration_exception{ "invalid capture configuration" };
+	}
+
+	if (path.empty() || max_body_size < 0 || buffer_size <= 0) {
+		throw configuration_exception{ "invalid capture configuration" };
+	}
+
+	this->max_body_size = static_cast<std::size_t>(max_body_size);
+	this->writer.reset(new traffic_log_writer{ path, static_cast<std::size_t>(buffer_size) });
+	this->start_time = std::chrono::steady_clock::now();
+}
+
+void traffic_capture::before_handle(crow::request&, crow::response&, context& ctx) {
+	if (this->writer) {
+		ctx.start = std::chrono::steady_clock::now();
+	}
+}
+
+void traffic_capture::after_handle(crow::request& req, crow::response& res, context& ctx) {
+	if (!this->writer) {
+		return;
+	}
+
+	const std::chrono::steady_clock::time_point end{ std::chrono::steady_clock::now() };
+	const std::uint64_t offset_us{ static_cast<std::uint64_t>(
+		std::chrono::duration_cast<std::chrono::microseconds>(ctx.start - this->start_time).count()
+	) };
+	const std::uint64_t duration_us{ static_cast<std::uint64_t>(
+		std::chrono::duration_cast<std::chrono::microseconds>(end - ctx.start).count()
+	) };
+
+	this->writer->write(
+		offset_us,
+		static_cast<std::uint32_t>(std::min<std::uint64_t>(duration_us, std::numeric_limits<std::uint32_t>::max())),
+		static_cast<std::uint16_t>(res.code),
+		crow::method_name(req.method),
+		req.raw_url,
+		req.body,
+		this->capture_bodies && req.body.size() <= this->max_body_size,
+		static_cast<std::uint32_t>(std::min<std::size_t>(res.body.size(), std::numeric_limits<std::uint32_t>::max()))
+	);
+}
+
+std::uint64_t traffic_capture::captured_requests() const {
+	return this->writer ? this->writer->written_records() : 0;
+}
+
+std::uint64_t traffic_capture::dropped_requests() const {
+	return this->writer ? this->writer->dropped_records() : 0;
+}
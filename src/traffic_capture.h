@@ -0,0 +1,53 @@
+#ifndef STEELBOX_TRAFFIC_CAPTURE_H
+#define STEELBOX_TRAFFIC_CAPTURE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <crow/http_request.h>
+#include <crow/http_response.h>
+#include <steeljson/value.h>
+#include "traffic_log.h"
+
+namespace steelbox {
+
+	const std::size_t default_capture_max_body_size = 64 * 1024;
+	const std::size_t default_capture_buffer_size = 16 * 1024 * 1024;
+
+	// crow middleware recording every request to a traffic log once started,
+	// a request costs one buffer append and nothing at all while disabled
+	class traffic_capture {
+		public:
+			struct context {
+				std::chrono::steady_clock::time_point start;
+			};
+
+		public:
+			traffic_capture();
+			traffic_capture(const traffic_capture&) = delete;
+
+			~traffic_capture() = default;
+
+			traffic_capture& operator=(const traffic_capture&) = delete;
+
+			// reads the "capture" configuration object: path, bodies, max_body_size and buffer_size
+			void start(const steeljson::object& config);
+
+			void before_handle(crow::request& req, crow::response& res, context& ctx);
+			void after_handle(crow::request& req, crow::response& res, context& ctx);
+
+			std::uint64_t captured_requests() const;
+			std::uint64_t dropped_requests() const;
+
+		private:
+			std::unique_ptr<traffic_log_writer> writer;
+			std::chrono::steady_clock::time_point start_time;
+			bool capture_bodies;
+			std::size_t max_body_size;
+	};
+
+}
+
+#endif // STEELBOX_TRAFFIC_CAPTURE_H
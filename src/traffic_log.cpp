@@ -0,0 +1,193 @@
+#include "traffic_log.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include "exception.h"
+
+using namespace steelbox;
+
+namespace {
+
+	template <typename T>
+	void append_integer(std::string& buffer, T value) {
+		for (std::size_t i = 0; i < sizeof(T); ++i) {
+			buffer.push_back(static_cast<char>((static_cast<std::uint64_t>(value) >> (8 * i)) & 0xFF));
+		}
+	}
+
+	template <typename T>
+	bool read_integer(std::istream& stream, T& value) {
+		unsigned char bytes[sizeof(T)];
+		if (!stream.read(reinterpret_cast<char*>(bytes), sizeof(T))) {
+			return false;
+		}
+
+		std::uint64_t result{ 0 };
+		for (std::size_t i = 0; i < sizeof(T); ++i) {
+			result |= static_cast<std::uint64_t>(bytes[i]) << (8 * i);
+		}
+		value = static_cast<T>(result);
+
+		return true;
+	}
+
+	void read_string(std::istream& stream, std::size_t size, std::string& value) {
+		value.resize(size);
+		if (size > 0 && !stream.read(&value[0], static_cast<std::streamsize>(size))) {
+			throw traffic_log_exception{ "truncated traffic log record" };
+		}
+	}
+
+}
+
+traffic_log_writer::traffic_log_writer(const std::string& path, std::size_t max_buffered_bytes) :
+	file(path, std::ios::binary | std::ios::trunc),
+	max_buffered_bytes(max_buffered_bytes),
+	stopping(false),
+	written(0),
+	dropped(0) {
+	if (!this->file) {
+		throw std::runtime_error{ "cannot open traffic log " + path };
+	}
+
+	const std::uint64_t start_ms{ static_cast<std::uint64_t>(
+		std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+	) };
+	std::string header(traffic_log_magic, sizeof(traffic_log_magic));
+	append_integer(header, start_ms);
+	this->file.write(header.data(), static_cast<std::streamsize>(header.size()));
+	this->file.flush();
+
+	this->thread = std::thread{ &traffic_log_writer::run, this };
+}
+
+traffic_log_writer::~traffic_log_writer() {
+	{
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		this->stopping = true;
+	}
+	this->data_available.notify_all();
+	this->thread.join();
+}
+
+bool traffic_log_writer::write(
+	std::uint64_t offset_us,
+	std::uint32_t duration_us,
+	std::uint16_t status,
+	const std::string& method,
+	const std::string& url,
+	const std::string& body,
+	bool capture_body,
+	std::uint32_t response_size
+) {
+	const std::size_t method_size{ std::min<std::size_t>(method.size(), std::numeric_limits<std::uint8_t>::max()) };
+	const std::size_t url_size{ std::min<std::size_t>(url.size(), std::numeric_limits<std::uint32_t>::max()) };
+	const std::size_t body_size{ std::min<std::size_t>(body.size(), std::numeric_limits<std::uint32_t>::max()) };
+	const std::size_t captured_body_size{ capture_body ? body_size : 0 };
+	const std::size_t record_size{ 8 + 4 + 2 + 1 + method_size + 4 + url_size + 4 + 4 + captured_body_size + 4 };
+
+	{
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		if (this->buffer.size() + record_size > this->max_buffered_bytes) {
+			++this->dropped;
+			return false;
+		}
+
+		append_integer(this->buffer, offset_us);
+		append_integer(this->buffer, duration_us);
+		append_integer(this->buffer, status);
+		append_integer(this->buffer, static_cast<std::uint8_t>(method_size));
+		this->buffer.append(method, 0, method_size);
+		append_integer(this->buffer, static_cast<std::uint32_t>(url_size));
+		this->buffer.append(url, 0, url_size);
+		append_integer(this->buffer, static_cast<std::uint32_t>(body_size));
+		append_integer(this->buffer, static_cast<std::uint32_t>(captured_body_size));
+		this->buffer.append(body, 0, captured_body_size);
+		append_integer(this->buffer, response_size);
+	}
+	++this->written;
+	this->data_available.notify_one();
+
+	return true;
+}
+
+std::uint64_t traffic_log_writer::written_records() const {
+	return this->written.load();
+}
+
+std::uint64_t traffic_log_writer::dropped_records() const {
+	return this->dropped.load();
+}
+
+void traffic_log_writer::run() {
+	std::string pending;
+	std::unique_lock<std::mutex> lock{ this->mutex };
+
+	while (true) {
+		this->data_available.wait(lock, [this]() { return this->stopping || !this->buffer.empty(); });
+		if (this->buffer.empty()) {
+			// stopping with nothing left to write
+			break;
+		}
+
+		// swap buffers so that requests keep appending while the file is written
+		std::swap(pending, this->buffer);
+		lock.unlock();
+		this->file.write(pending.data(), static_cast<std::streamsize>(pending.size()));
+		this->file.flush();
+		pending.clear();
+		lock.lock();
+	}
+}
+
+traffic_log_reader::traffic_log_reader(const std::string& path) :
+	file(path, std::ios::binary),
+	start_ms(0) {
+	if (!this->file) {
+		throw traffic_log_exception{ "cannot open traffic log " + path };
+	}
+
+	char magic[sizeof(traffic_log_magic)];
+	if (!this->file.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), traffic_log_magic) || !read_integer(this->file, this->start_ms)) {
+		throw traffic_log_exception{ "not a traffic log" };
+	}
+}
+
+bool traffic_log_reader::next(traffic_record& record) {
+	if (!read_integer(this->file, record.offset_us)) {
+		if (this->file.gcount() != 0) {
+			throw traffic_log_exception{ "truncated traffic log record" };
+		}
+		return false;
+	}
+
+	std::uint8_t method_size;
+	std::uint32_t url_size;
+	std::uint32_t captured_body_size;
+	if (!read_integer(this->file, record.duration_us) || !read_integer(this->file, record.status) || !read_integer(this->file, method_size)) {
+		throw traffic_log_exception{ "truncated traffic log record" };
+	}
+	read_string(this->file, method_size, record.method);
+	if (!read_integer(this->file, url_size)) {
+		throw traffic_log_exception{ "truncated traffic log record" };
+	}
+	read_string(this->file, url_size, record.url);
+	if (!read_integer(this->file, record.body_size) || !read_integer(this->file, captured_body_size)) {
+		throw traffic_log_exception{ "truncated traffic log record" };
+	}
+	if (captured_body_size != 0 && captured_body_size != record.body_size) {
+		throw traffic_log_exception{ "inconsistent traffic log record" };
+	}
+	read_string(this->file, captured_body_size, record.body);
+	if (!read_integer(this->file, record.response_size)) {
+		throw traffic_log_exception{ "truncated traffic log record" };
+	}
+
+	return true;
+}
+
+std::uint64_t traffic_log_reader::capture_start_ms() const {
+	return this->start_ms;
+}
@@ -0,0 +1,96 @@
+#ifndef STEELBOX_TRAFFIC_LOG_H
+#define STEELBOX_TRAFFIC_LOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace steelbox {
+
+	// The log starts with traffic_log_magic and the capture start time in
+	// milliseconds since the epoch, followed by records of little-endian fields:
+	//   u64 offset_us, u32 duration_us, u16 status, u8 method size, method,
+	//   u32 url size, url, u32 body_size, u32 captured body size, body, u32 response_size
+	const char traffic_log_magic[8] = { 'S', 'B', 'T', 'R', 'A', 'F', 'F', '1' };
+
+	struct traffic_record {
+		// time the request arrived, relative to the start of the capture
+		std::uint64_t offset_us;
+		std::uint32_t duration_us;
+		std::uint16_t status;
+		std::string method;
+		// path including the query string
+		std::string url;
+		std::uint32_t body_size;
+		// empty when the body was not captured, body_size is kept either way
+		std::string body;
+		std::uint32_t response_size;
+	};
+
+	// Appends records to a traffic log from many threads. Records are encoded
+	// into a memory buffer and written out by a background thread; when the
+	// buffer is full, records are dropped instead of blocking the caller.
+	class traffic_log_writer {
+		public:
+			traffic_log_writer(const std::string& path, std::size_t max_buffered_bytes);
+			traffic_log_writer(const traffic_log_writer&) = delete;
+
+			~traffic_log_writer();
+
+			traffic_log_writer& operator=(const traffic_log_writer&) = delete;
+
+			// returns false if the record was dropped
+			bool write(
+				std::uint64_t offset_us,
+				std::uint32_t duration_us,
+				std::uint16_t status,
+				const std::string& method,
+				const std::string& url,
+				const std::string& body,
+				bool capture_body,
+				std::uint32_t response_size
+			);
+			std::uint64_t written_records() const;
+			std::uint64_t dropped_records() const;
+
+		private:
+			void run();
+
+		private:
+			std::ofstream file;
+			std::size_t max_buffered_bytes;
+			std::mutex mutex;
+			std::condition_variable data_available;
+			std::string buffer;
+			bool stopping;
+			std::atomic<std::uint64_t> written;
+			std::atomic<std::uint64_t> dropped;
+			std::thread thread;
+	};
+
+	class traffic_log_reader {
+		public:
+			traffic_log_reader(const std::string& path);
+			traffic_log_reader(const traffic_log_reader&) = delete;
+
+			~traffic_log_reader() = default;
+
+			traffic_log_reader& operator=(const traffic_log_reader&) = delete;
+
+			// returns false at the end of the log, throws traffic_log_exception if it is malformed
+			bool next(traffic_record& record);
+			std::uint64_t capture_start_ms() const;
+
+		private:
+			std::ifstream file;
+			std::uint64_t start_ms;
+	};
+
+}
+
+#endif // STEELBOX_TRAFFIC_LOG_H
@@ -0,0 +1,403 @@
+#include "utf8.h"
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define STEELBOX_UTF8_X86_64
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(STEELBOX_UTF8_X86_64) && (defined(__GNUC__) || defined(__clang__))
+#define STEELBOX_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define STEELBOX_TARGET_AVX2
+#endif
+
+using namespace steelbox;
+
+namespace {
+
+	// validates the multi-byte sequence starting at data and returns its length, or 0 if it is invalid
+	std::size_t validate_sequence(const unsigned char* data, std::size_t size) {
+		const unsigned char lead{ data[0] };
+		std::size_t length;
+		unsigned char second_min{ 0x80 };
+		unsigned char second_max{ 0xBF };
+
+		if (lead >= 0xC2 && lead <= 0xDF) {
+			length = 2;
+		} else if (lead >= 0xE0 && lead <= 0xEF) {
+			length = 3;
+			if (lead == 0xE0) {
+				second_min = 0xA0; // overlong
+			} else if (lead == 0xED) {
+				second_max = 0x9F; // surrogates
+			}
+		} else if (lead >= 0xF0 && lead <= 0xF4) {
+			length = 4;
+			if (lead == 0xF0) {
+				second_min = 0x90; // overlong
+			} else if (lead == 0xF4) {
+				second_max = 0x8F; // above U+10FFFF
+			}
+		} else {
+			return 0;
+		}
+
+		if (size < length || data[1] < second_min || data[1] > second_max) {
+			return 0;
+		}
+		for (std::size_t i = 2; i < length; ++i) {
+			if (data[i] < 0x80 || data[i] > 0xBF) {
+				return 0;
+			}
+		}
+
+		return length;
+	}
+
+	bool needs_json_escape(unsigned char c) {
+		return c < 0x20 || c == '"' || c == '\\';
+	}
+
+	std::size_t skip_ascii_scalar(const unsigned char* data, std::size_t position, std::size_t size) {
+		while (position < size && data[position] < 0x80) {
+			++position;
+		}
+
+		return position;
+	}
+
+	std::size_t find_json_escape_from_scalar(const unsigned char* data, std::size_t position, std::size_t size) {
+		while (position < size && !needs_json_escape(data[position])) {
+			++position;
+		}
+
+		return position;
+	}
+
+	using scan_function = std::size_t (*)(const unsigned char*, std::size_t, std::size_t);
+	using validate_function = bool (*)(const unsigned char*, std::size_t);
+
+	bool is_valid_utf8_with(scan_function skip_ascii, const unsigned char* data, std::size_t size) {
+		std::size_t position{ 0 };
+
+		while (true) {
+			position = skip_ascii(data, position, size);
+			if (position == size) {
+				return true;
+			}
+
+			const std::size_t length{ validate_sequence(data + position, size - position) };
+			if (length == 0) {
+				return false;
+			}
+			position += length;
+		}
+	}
+
+	bool is_valid_utf8_from_scalar(const unsigned char* data, std::size_t size) {
+		return is_valid_utf8_with(skip_ascii_scalar, data, size);
+	}
+
+#if defined(STEELBOX_UTF8_X86_64)
+	unsigned count_trailing_zeros(std::uint32_t mask) {
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return static_cast<unsigned>(index);
+#else
+		return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+	}
+
+	std::size_t skip_ascii_sse2(const unsigned char* data, std::size_t position, std::size_t size) {
+		for (; position + 16 <= size; position += 16) {
+			const __m128i block{ _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position)) };
+			const std::uint32_t mask{ static_cast<std::uint32_t>(_mm_movemask_epi8(block)) };
+			if (mask != 0) {
+				return position + count_trailing_zeros(mask);
+			}
+		}
+
+		return skip_ascii_scalar(data, position, size);
+	}
+
+	// without AVX2 only the ASCII runs are skipped, multi-byte sequences are validated one by one
+	bool is_valid_utf8_sse2(const unsigned char* data, std::size_t size) {
+		return is_valid_utf8_with(skip_ascii_sse2, data, size);
+	}
+
+	std::size_t find_json_escape_from_sse2(const unsigned char* data, std::size_t position, std::size_t size) {
+		const __m128i quote{ _mm_set1_epi8('"') };
+		const __m128i backslash{ _mm_set1_epi8('\\') };
+		const __m128i control_max{ _mm_set1_epi8(0x1F) };
+
+		for (; position + 16 <= size; position += 16) {
+			const __m128i block{ _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position)) };
+			// unsigned block <= 0x1F is max(block, 0x1F) == 0x1F
+			const __m128i escaped{ _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+				_mm_cmpeq_epi8(_mm_max_epu8(block, control_max), control_max)
+			) };
+			const std::uint32_t mask{ static_cast<std::uint32_t>(_mm_movemask_epi8(escaped)) };
+			if (mask != 0) {
+				return position + count_trailing_zeros(mask);
+			}
+		}
+
+		return find_json_escape_from_scalar(data, position, size);
+	}
+
+	STEELBOX_TARGET_AVX2 std::size_t find_json_escape_from_avx2(const unsigned char* data, std::size_t position, std::size_t size) {
+		const __m256i quote{ _mm256_set1_epi8('"') };
+		const __m256i backslash{ _mm256_set1_epi8('\\') };
+		const __m256i control_max{ _mm256_set1_epi8(0x1F) };
+
+		for (; position + 32 <= size; position += 32) {
+			const __m256i block{ _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + position)) };
+			const __m256i escaped{ _mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(block, quote), _mm256_cmpeq_epi8(block, backslash)),
+				_mm256_cmpeq_epi8(_mm256_max_epu8(block, control_max), control_max)
+			) };
+			const std::uint32_t mask{ static_cast<std::uint32_t>(_mm256_movemask_epi8(escaped)) };
+			if (mask != 0) {
+				return position + count_trailing_zeros(mask);
+			}
+		}
+
+		return find_json_escape_from_sse2(data, position, size);
+	}
+
+	// Multi-byte text is validated 32 bytes at a time with the lookup tables of
+	// Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte".
+	// Each error class below is a bit, a byte pair is invalid when the classes
+	// of the first byte's high and low nibbles and of the second byte's high nibble share one.
+	const std::uint8_t too_short = 1 << 0; // lead byte not followed by a continuation
+	const std::uint8_t too_long = 1 << 1; // continuation after an ASCII byte
+	const std::uint8_t overlong_3 = 1 << 2;
+	const std::uint8_t too_large = 1 << 3; // above U+10FFFF
+	const std::uint8_t surrogate = 1 << 4;
+	const std::uint8_t overlong_2 = 1 << 5;
+	const std::uint8_t too_large_1000 = 1 << 6;
+	const std::uint8_t overlong_4 = 1 << 6;
+	const std::uint8_t two_continuations = 1 << 7; // checked against the expected lengths afterwards
+	const std::uint8_t carry = too_short | too_long | two_continuations;
+
+	STEELBOX_TARGET_AVX2 __m256i lookup_nibbles(const __m256i& table, const __m256i& nibbles) {
+		return _mm256_shuffle_epi8(table, nibbles);
+	}
+
+	STEELBOX_TARGET_AVX2 __m256i high_nibbles(const __m256i& bytes) {
+		return _mm256_and_si256(_mm256_srli_epi16(bytes, 4), _mm256_set1_epi8(0x0F));
+	}
+
+	// the bytes of block shifted by count, with the last bytes of previous shifted in
+	template<int count>
+	STEELBOX_TARGET_AVX2 __m256i preceding_bytes(const __m256i& block, const __m256i& previous) {
+		return _mm256_alignr_epi8(block, _mm256_permute2x128_si256(previous, block, 0x21), 16 - count);
+	}
+
+	STEELBOX_TARGET_AVX2 __m256i check_special_cases(const __m256i& block, const __m256i& previous_1) {
+		const __m256i byte_1_high_table{ _mm256_setr_epi8(
+			// 0_______ ________
+			too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+			// 10______ ________
+			two_continuations, two_continuations, two_continuations, two_continuations,
+			// 1100____ ________
+			too_short | overlong_2,
+			// 1101____ ________
+			too_short,
+			// 1110____ ________
+			too_short | overlong_3 | surrogate,
+			// 1111____ ________
+			too_short | too_large | too_large_1000 | overlong_4,
+			too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+			two_continuations, two_continuations, two_continuations, two_continuations,
+			too_short | overlong_2,
+			too_short,
+			too_short | overlong_3 | surrogate,
+			too_short | too_large | too_large_1000 | overlong_4
+		) };
+		const __m256i byte_1_low_table{ _mm256_setr_epi8(
+			// ____0000 ________
+			carry | overlong_3 | overlong_2 | overlong_4,
+			// ____0001 ________
+			carry | overlong_2,
+			// ____001_ ________
+			carry, carry,
+			// ____0100 ________
+			carry | too_large,
+			// ____0101 ________ to ____1100 ________
+			carry | too_large | too_large_1000, carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000, carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+			// ____1101 ________
+			carry | too_large | too_large_1000 | surrogate,
+			// ____111_ ________
+			carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+			carry | overlong_3 | overlong_2 | overlong_4,
+			carry | overlong_2,
+			carry, carry,
+			carry | too_large,
+			carry | too_large | too_large_1000, carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000, carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000 | surrogate,
+			carry | too_large | too_large_1000, carry | too_large | too_large_1000
+		) };
+		const __m256i byte_2_high_table{ _mm256_setr_epi8(
+			// ________ 0_______
+			too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+			// ________ 1000____
+			too_long | overlong_2 | two_continuations | overlong_3 | too_large_1000 | overlong_4,
+			// ________ 1001____
+			too_long | overlong_2 | two_continuations | overlong_3 | too_large,
+			// ________ 101_____
+			too_long | overlong_2 | two_continuations | surrogate | too_large,
+			too_long | overlong_2 | two_continuations | surrogate | too_large,
+			// ________ 11______
+			too_short, too_short, too_short, too_short,
+			too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+			too_long | overlong_2 | two_continuations | overlong_3 | too_large_1000 | overlong_4,
+			too_long | overlong_2 | two_continuations | overlong_3 | too_large,
+			too_long | overlong_2 | two_continuations | surrogate | too_large,
+			too_long | overlong_2 | two_continuations | surrogate | too_large,
+			too_short, too_short, too_short, too_short
+		) };
+
+		return _mm256_and_si256(
+			_mm256_and_si256(
+				lookup_nibbles(byte_1_high_table, high_nibbles(previous_1)),
+				lookup_nibbles(byte_1_low_table, _mm256_and_si256(previous_1, _mm256_set1_epi8(0x0F)))
+			),
+			lookup_nibbles(byte_2_high_table, high_nibbles(block))
+		);
+	}
+
+	// two continuations in a row are only valid as the third or fourth byte of a sequence
+	STEELBOX_TARGET_AVX2 __m256i check_multibyte_lengths(const __m256i& block, const __m256i& previous, const __m256i& special_cases) {
+		const __m256i previous_2{ preceding_bytes<2>(block, previous) };
+		const __m256i previous_3{ preceding_bytes<3>(block, previous) };
+		// only 111_____ two bytes back or 1111____ three bytes back end up at or above 0x80
+		const __m256i is_third_byte{ _mm256_subs_epu8(previous_2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80))) };
+		const __m256i is_fourth_byte{ _mm256_subs_epu8(previous_3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80))) };
+		const __m256i must_be_continuation{ _mm256_and_si256(_mm256_or_si256(is_third_byte, is_fourth_byte), _mm256_set1_epi8(static_cast<char>(0x80))) };
+
+		return _mm256_xor_si256(must_be_continuation, special_cases);
+	}
+
+	// nonzero when the block ends inside a sequence that the next block has to complete
+	STEELBOX_TARGET_AVX2 __m256i find_incomplete(const __m256i& block) {
+		const __m256i max_complete{ _mm256_setr_epi8(
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1)
+		) };
+
+		return _mm256_subs_epu8(block, max_complete);
+	}
+
+	struct utf8_validation_state {
+		__m256i previous;
+		__m256i previous_incomplete;
+		__m256i errors;
+	};
+
+	STEELBOX_TARGET_AVX2 void check_utf8_block(utf8_validation_state& state, const __m256i& block) {
+		if (_mm256_movemask_epi8(block) == 0) {
+			// an ASCII block cannot complete a sequence the previous block left open
+			state.errors = _mm256_or_si256(state.errors, state.previous_incomplete);
+			state.previous_incomplete = _mm256_setzero_si256();
+		} else {
+			const __m256i special_cases{ check_special_cases(block, preceding_bytes<1>(block, state.previous)) };
+			state.errors = _mm256_or_si256(state.errors, check_multibyte_lengths(block, state.previous, special_cases));
+			state.previous_incomplete = find_incomplete(block);
+		}
+		state.previous = block;
+	}
+
+	STEELBOX_TARGET_AVX2 bool is_valid_utf8_avx2(const unsigned char* data, std::size_t size) {
+		utf8_validation_state state;
+		state.previous = _mm256_setzero_si256();
+		state.previous_incomplete = _mm256_setzero_si256();
+		state.errors = _mm256_setzero_si256();
+
+		std::size_t position{ 0 };
+		for (; position + 32 <= size; position += 32) {
+			check_utf8_block(state, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + position)));
+		}
+		// zero padding is ASCII, so a sequence cut off by the end is reported as too short
+		if (position < size) {
+			unsigned char tail[32] = { };
+			std::memcpy(tail, data + position, size - position);
+			check_utf8_block(state, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail)));
+		}
+		state.errors = _mm256_or_si256(state.errors, state.previous_incomplete);
+
+		return _mm256_testz_si256(state.errors, state.errors) != 0;
+	}
+
+	bool cpu_supports_avx2() {
+#if defined(_MSC_VER)
+		int registers[4];
+		__cpuid(registers, 0);
+		if (registers[0] < 7) {
+			return false;
+		}
+		__cpuid(registers, 1);
+		const bool os_saves_ymm{ (registers[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6 };
+		__cpuidex(registers, 7, 0);
+		return os_saves_ymm && (registers[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}
+#endif
+
+	struct scan_functions {
+		scan_functions() :
+			is_valid_utf8(is_valid_utf8_from_scalar),
+			find_json_escape_from(find_json_escape_from_scalar) {
+#if defined(STEELBOX_UTF8_X86_64)
+			if (cpu_supports_avx2()) {
+				this->is_valid_utf8 = is_valid_utf8_avx2;
+				this->find_json_escape_from = find_json_escape_from_avx2;
+			} else {
+				this->is_valid_utf8 = is_valid_utf8_sse2;
+				this->find_json_escape_from = find_json_escape_from_sse2;
+			}
+#endif
+		}
+
+		validate_function is_valid_utf8;
+		scan_function find_json_escape_from;
+	};
+
+	const scan_functions& dispatched_scan_functions() {
+		static const scan_functions functions;
+
+		return functions;
+	}
+
+}
+
+bool steelbox::is_valid_utf8(const char* data, std::size_t size) {
+	return dispatched_scan_functions().is_valid_utf8(reinterpret_cast<const unsigned char*>(data), size);
+}
+
+std::size_t steelbox::find_json_escape(const char* data, std::size_t size) {
+	return dispatched_scan_functions().find_json_escape_from(reinterpret_cast<const unsigned char*>(data), 0, size);
+}
+
+bool steelbox::is_valid_utf8_scalar(const char* data, std::size_t size) {
+	return is_valid_utf8_from_scalar(reinterpret_cast<const unsigned char*>(data), size);
+}
+
+std::size_t steelbox::find_json_escape_scalar(const char* data, std::size_t size) {
+	return find_json_escape_from_scalar(reinterpret_cast<const unsigned char*>(data), 0, size);
+}
@@ -0,0 +1,20 @@
+#ifndef STEELBOX_UTF8_H
+#define STEELBOX_UTF8_H
+
+#include <cstddef>
+
+namespace steelbox {
+
+	// With AVX2 both functions check 32 bytes at a time, multi-byte text included.
+	// With SSE2 they skip ASCII runs 16 bytes at a time and validate multi-byte
+	// sequences one by one, elsewhere they fall back to the scalar implementations.
+	bool is_valid_utf8(const char* data, std::size_t size);
+	// returns the position of the first byte a JSON string must escape, or size if there is none
+	std::size_t find_json_escape(const char* data, std::size_t size);
+
+	bool is_valid_utf8_scalar(const char* data, std::size_t size);
+	std::size_t find_json_escape_scalar(const char* data, std::size_t size);
+
+}
+
+#endif // STEELBOX_UTF8_H
@@ -0,0 +1,366 @@
+#include "worker_launcher.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#endif
+
+using namespace steelbox;
+
+namespace {
+
+	const std::chrono::milliseconds initial_restart_delay{ 1000 };
+	const std::chrono::milliseconds maximum_restart_delay{ 30000 };
+	// a worker running at least this long is not failing on start, its next restart is immediate
+	const std::chrono::seconds stable_duration{ 10 };
+	// stopping workers still running after this long are killed
+	const std::chrono::seconds stop_timeout{ 30 };
+	const int maximum_wait_ms = 1000;
+
+	std::system_error system_failure(const std::string& what) {
+		return std::system_error{ errno, std::system_category(), what };
+	}
+
+	std::string describe_exit(int status) {
+		if (WIFEXITED(status)) {
+			return "exited with status " + std::to_string(WEXITSTATUS(status));
+		} else if (WIFSIGNALED(status)) {
+			return "was killed by signal " + std::to_string(WTERMSIG(status));
+		}
+
+		return "stopped";
+	}
+
+}
+
+worker_launcher::worker_slot::worker_slot() :
+	pid(0),
+	restart_delay(initial_restart_delay),
+	replacement(0) {
+}
+
+worker_launcher::worker_launcher(std::size_t workers, const worker_function& worker, const reload_function& reload) :
+	workers(workers),
+	worker(worker),
+	reload(reload),
+	launcher_pid(0),
+	signal_fd(-1),
+	stopping(false),
+	killed(false) {
+	if (workers == 0) {
+		throw std::invalid_argument{ "at least one worker is required" };
+	}
+}
+
+int worker_launcher::run() {
+#ifdef __linux__
+	this->launcher_pid = ::getpid();
+
+	// signals are only received through signal_fd, and unblocked again in the workers
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR2);
+	sigaddset(&mask, SIGHUP);
+	if (::sigprocmask(SIG_BLOCK, &mask, &this->original_mask) != 0) {
+		throw system_failure("sigprocmask");
+	}
+	this->signal_fd = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (this->signal_fd < 0) {
+		throw system_failure("signalfd");
+	}
+
+	this->slots.resize(this->workers);
+	for (std::size_t slot = 0; slot < this->workers; ++slot) {
+		this->slots[slot].pid = this->spawn(slot);
+	}
+
+	while (!this->stopping || !this->processes.empty()) {
+		const std::chrono::steady_clock::time_point now{ std::chrono::steady_clock::now() };
+		if (this->stopping) {
+			if (!this->killed && now >= this->stop_deadline) {
+				std::cerr << "workers did not stop in time, killing them" << std::endl;
+				for (const std::map<pid_t, worker_process>::value_type& process : this->processes) {
+					::kill(process.first, SIGKILL);
+				}
+				this->killed = true;
+			}
+		} else {
+			for (std::size_t slot = 0; slot < this->workers; ++slot) {
+				if (this->slots[slot].pid == 0 && now >= this->slots[slot].restart_at) {
+					this->slots[slot].pid = this->spawn(slot);
+				}
+			}
+		}
+
+		std::vector<pollfd> descriptors;
+		std::vector<pid_t> descriptor_pids;
+		descriptors.push_back(pollfd{ this->signal_fd, POLLIN, 0 });
+		descriptor_pids.push_back(0);
+		for (const std::map<pid_t, worker_process>::value_type& process : this->processes) {
+			if (process.second.ready_fd >= 0) {
+				descriptors.push_back(pollfd{ process.second.ready_fd, POLLIN, 0 });
+				descriptor_pids.push_back(process.first);
+			}
+		}
+
+		if (::poll(descriptors.data(), descriptors.size(), this->wait_timeout()) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw system_failure("poll");
+		}
+
+		for (std::size_t i = 1; i < descriptors.size(); ++i) {
+			if (descriptors[i].revents == 0) {
+				continue;
+			}
+			const std::map<pid_t, worker_process>::iterator process_it{ this->processes.find(descriptor_pids[i]) };
+			char ready;
+			const ssize_t read_bytes{ ::read(process_it->second.ready_fd, &ready, 1) };
+			if (read_bytes < 0 && errno == EINTR) {
+				continue;
+			}
+			::close(process_it->second.ready_fd);
+			process_it->second.ready_fd = -1;
+			// end of file means the worker exited before being ready, which reap handles
+			if (read_bytes == 1) {
+				this->on_ready(process_it->first);
+			}
+		}
+
+		if (descriptors[0].revents != 0) {
+			signalfd_siginfo signal_info;
+			while (::read(this->signal_fd, &signal_info, sizeof(signal_info)) == sizeof(signal_info)) {
+				switch (signal_info.ssi_signo) {
+					case SIGCHLD: {
+						this->reap();
+						break;
+					}
+					case SIGINT:
+					case SIGTERM: {
+						if (!this->stopping) {
+							this->stop_all();
+						}
+						break;
+					}
+					case SIGUSR2: {
+						if (!this->stopping && this->pending_restarts.empty()) {
+							std::cerr << "restarting workers" << std::endl;
+							for (std::size_t slot = 0; slot < this->workers; ++slot) {
+								this->pending_restarts.push_back(slot);
+							}
+							this->restart_next();
+						}
+						break;
+					}
+					case SIGHUP: {
+						if (!this->stopping) {
+							// workers forked from now on start with what was reloaded
+							if (this->reload) {
+								try {
+									this->reload();
+								} catch (...) {
+								}
+							}
+							std::cerr << "reloading workers" << std::endl;
+							for (const std::map<pid_t, worker_process>::value_type& process : this->processes) {
+								if (!process.second.retired) {
+									::kill(process.first, SIGHUP);
+								}
+							}
+						}
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	::close(this->signal_fd);
+	this->signal_fd = -1;
+	::sigprocmask(SIG_SETMASK, &this->original_mask, nullptr);
+
+	return 0;
+#else
+	throw std::runtime_error{ "workers are only supported on Linux" };
+#endif
+}
+
+pid_t worker_launcher::spawn(std::size_t slot) {
+#ifdef __linux__
+	int ready_pipe[2];
+	if (::pipe2(ready_pipe, O_CLOEXEC) != 0) {
+		throw system_failure("pipe2");
+	}
+
+	const pid_t pid{ ::fork() };
+	if (pid < 0) {
+		::close(ready_pipe[0]);
+		::close(ready_pipe[1]);
+		throw system_failure("fork");
+	}
+
+	if (pid == 0) {
+		::close(ready_pipe[0]);
+		::close(this->signal_fd);
+		for (const std::map<pid_t, worker_process>::value_type& process : this->processes) {
+			if (process.second.ready_fd >= 0) {
+				::close(process.second.ready_fd);
+			}
+		}
+		// SIGHUP stays blocked for the worker to take it once it listens for reloads,
+		// instead of dying from one forwarded while it is still starting
+		sigset_t worker_mask{ this->original_mask };
+		sigaddset(&worker_mask, SIGHUP);
+		::sigprocmask(SIG_SETMASK, &worker_mask, nullptr);
+		// workers must not outlive a launcher that crashed
+		::prctl(PR_SET_PDEATHSIG, SIGTERM);
+		if (::getppid() != this->launcher_pid) {
+			::_exit(1);
+		}
+
+		const std::shared_ptr<int> ready_fd{ std::make_shared<int>(ready_pipe[1]) };
+		int status{ 1 };
+		try {
+			status = this->worker(slot, [ready_fd]() {
+				if (*ready_fd >= 0) {
+					const char ready{ 'r' };
+					while (::write(*ready_fd, &ready, 1) < 0 && errno == EINTR) {
+					}
+					::close(*ready_fd);
+					*ready_fd = -1;
+				}
+			});
+		} catch (const std::exception& e) {
+			std::cerr << "worker " << slot << " failed: " << e.what() << std::endl;
+		} catch (...) {
+			std::cerr << "worker " << slot << " failed" << std::endl;
+		}
+		std::exit(status);
+	}
+
+	::close(ready_pipe[1]);
+	this->processes.insert(std::make_pair(pid, worker_process{ slot, std::chrono::steady_clock::now(), ready_pipe[0], false }));
+
+	return pid;
+#else
+	(void)slot;
+	throw std::runtime_error{ "workers are only supported on Linux" };
+#endif
+}
+
+void worker_launcher::reap() {
+	int status;
+	pid_t pid;
+	while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0) {
+		const std::map<pid_t, worker_process>::iterator process_it{ this->processes.find(pid) };
+		if (process_it == this->processes.end()) {
+			continue;
+		}
+
+		const worker_process process{ process_it->second };
+		if (process.ready_fd >= 0) {
+			::close(process.ready_fd);
+		}
+		this->processes.erase(process_it);
+		if (process.retired || this->stopping) {
+			continue;
+		}
+
+		worker_slot& slot{ this->slots[process.slot] };
+		std::cerr << "worker " << process.slot << " (" << pid << ") " << describe_exit(status) << std::endl;
+		if (slot.replacement == pid) {
+			// keep the old worker serving and give up the rest of the restart
+			std::cerr << "restart of the workers aborted" << std::endl;
+			slot.replacement = 0;
+			this->pending_restarts.clear();
+		} else if (slot.pid == pid) {
+			if (slot.replacement != 0) {
+				slot.pid = slot.replacement;
+				slot.replacement = 0;
+				this->pending_restarts.pop_front();
+				this->restart_next();
+				continue;
+			}
+
+			const std::chrono::steady_clock::time_point now{ std::chrono::steady_clock::now() };
+			if (now - process.started >= stable_duration) {
+				slot.restart_delay = initial_restart_delay;
+			}
+			slot.pid = 0;
+			slot.restart_at = now + slot.restart_delay;
+			slot.restart_delay = std::min(slot.restart_delay * 2, maximum_restart_delay);
+		}
+	}
+}
+
+void worker_launcher::on_ready(pid_t pid) {
+	worker_slot& slot{ this->slots[this->processes.at(pid).slot] };
+	if (slot.replacement != pid) {
+		return;
+	}
+
+	// crow stops on SIGTERM, the kernel moves new connections to the remaining listeners
+	this->processes.at(slot.pid).retired = true;
+	::kill(slot.pid, SIGTERM);
+	slot.pid = pid;
+	slot.replacement = 0;
+	this->pending_restarts.pop_front();
+	this->restart_next();
+}
+
+void worker_launcher::restart_next() {
+	while (!this->pending_restarts.empty()) {
+		worker_slot& slot{ this->slots[this->pending_restarts.front()] };
+		// a slot waiting to be started again gets a fresh worker anyway
+		if (slot.pid == 0) {
+			this->pending_restarts.pop_front();
+			continue;
+		}
+		slot.replacement = this->spawn(this->pending_restarts.front());
+		return;
+	}
+
+	std::cerr << "workers restarted" << std::endl;
+}
+
+void worker_launcher::stop_all() {
+	this->stopping = true;
+	this->pending_restarts.clear();
+	this->stop_deadline = std::chrono::steady_clock::now() + stop_timeout;
+	for (const std::map<pid_t, worker_process>::value_type& process : this->processes) {
+		::kill(process.first, SIGTERM);
+	}
+}
+
+int worker_launcher::wait_timeout() const {
+	const std::chrono::steady_clock::time_point now{ std::chrono::steady_clock::now() };
+	std::chrono::milliseconds timeout{ maximum_wait_ms };
+	if (this->stopping) {
+		if (!this->killed) {
+			timeout = std::min(timeout, std::chrono::duration_cast<std::chrono::milliseconds>(this->stop_deadline - now));
+		}
+	} else {
+		for (const worker_slot& slot : this->slots) {
+			if (slot.pid == 0) {
+				timeout = std::min(timeout, std::chrono::duration_cast<std::chrono::milliseconds>(slot.restart_at - now));
+			}
+		}
+	}
+
+	return static_cast<int>(std::max(timeout, std::chrono::milliseconds{ 0 }).count());
+}
@@ -0,0 +1,88 @@
+#ifndef STEELBOX_WORKER_LAUNCHER_H
+#define STEELBOX_WORKER_LAUNCHER_H
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+#include <signal.h>
+#include <sys/types.h>
+
+namespace steelbox {
+
+	// Runs a worker function in several child processes and supervises them.
+	// A worker exiting unexpectedly is started again after a delay growing while it keeps
+	// failing early. SIGTERM and SIGINT stop the workers and the launcher, SIGUSR2 replaces
+	// the workers one at a time, stopping each old worker only after its replacement is ready.
+	// SIGHUP is forwarded to the workers, which start with it blocked, after the launcher
+	// reloaded what the workers it starts afterwards are given.
+	// Workers are forked before anything else is set up, so that they share no threads,
+	// connections or locks. Only available on Linux.
+	class worker_launcher {
+		public:
+			// called in the worker process with its slot, in [0, workers), and a function
+			// to call once it is ready to serve, returns the exit status of the worker
+			using worker_function = std::function<int(std::size_t slot, const std::function<void()>& ready)>;
+			// called in the launcher on SIGHUP, exceptions are swallowed
+			using reload_function = std::function<void()>;
+
+			worker_launcher(std::size_t workers, const worker_function& worker, const reload_function& reload = { });
+			worker_launcher(const worker_launcher&) = delete;
+
+			~worker_launcher() = default;
+
+			worker_launcher& operator=(const worker_launcher&) = delete;
+
+			// returns once every worker has stopped after SIGTERM or SIGINT,
+			// throws std::system_error when the processes cannot be managed
+			int run();
+
+		private:
+			struct worker_process {
+				std::size_t slot;
+				std::chrono::steady_clock::time_point started;
+				// read end of the pipe the worker writes to when it is ready, -1 once it is
+				int ready_fd;
+				// replaced by a newer worker and being stopped
+				bool retired;
+			};
+
+			struct worker_slot {
+				worker_slot();
+
+				pid_t pid;
+				std::chrono::milliseconds restart_delay;
+				// when the slot has no worker, time at which it is started again
+				std::chrono::steady_clock::time_point restart_at;
+				// worker replacing pid during a restart
+				pid_t replacement;
+			};
+
+			pid_t spawn(std::size_t slot);
+			void reap();
+			void on_ready(pid_t pid);
+			void restart_next();
+			void stop_all();
+			int wait_timeout() const;
+
+		private:
+			std::size_t workers;
+			worker_function worker;
+			reload_function reload;
+			pid_t launcher_pid;
+			sigset_t original_mask;
+			int signal_fd;
+			std::map<pid_t, worker_process> processes;
+			std::vector<worker_slot> slots;
+			// slots still to replace in the running restart
+			std::deque<std::size_t> pending_restarts;
+			bool stopping;
+			std::chrono::steady_clock::time_point stop_deadline;
+			bool killed;
+	};
+
+}
+
+#endif // STEELBOX_WORKER_LAUNCHER_H